@@ -0,0 +1,27 @@
+#include <cstdio>
+
+// built with -fno-rtti -fno-exceptions: yacl.hpp provides the embedded configuration
+#include "yacl.hpp"
+
+int main(int argc, char** argv) {
+  yacl::arg_view host("localhost", 9);
+  int port = 80;
+  double ratio = 1.0;
+  bool verbose = false;
+
+  yacl::fixed_map<4> map;
+  map.req("host", 'h', host, "the remote host name");
+  map.opt("port", 'p', port, "the remote host port");
+  map.opt("ratio", 0, ratio, "the sampling ratio");
+  map.opt("verbose", 'v', verbose, "verbose");
+
+  if (map.parse(argc, argv) != yacl::PARSE_OK) {
+    std::fprintf(stderr, "%s: %.*s\n", yacl::describe(map.status()),
+                 static_cast<int>(map.error().size()), map.error().data());
+    return 1;
+  }
+
+  std::printf("%.*s:%d ratio=%g verbose=%d (%zu ignored)\n",
+              static_cast<int>(host.size()), host.data(), port, ratio, verbose, map.ignored());
+  return 0;
+}
@@ -1,5 +1,11 @@
 #include "tests_yacl.hpp"
 #include "yacl.hpp"
+#include "yacl_embedded.hpp"
+
+#ifndef YACL_LIBRARY
+#define YACL_GETOPT_IMPLEMENTATION
+#endif
+#include "yacl_getopt.h"
 
 namespace yacl {
 namespace test {
@@ -17,6 +23,12 @@ TEST_F(tests_yacl, map_simple_values) {
 
   ASSERT_EQ(map["host"].help(), "the remote host name");
 
+  // still valid once more options are declared
+  const std::string& help = map["host"].help();
+  for (int i = 0; i < 100; ++i)
+    map["extra" + std::to_string(i)].opt<int>("", "an extra option", i);
+  ASSERT_EQ(help, "the remote host name");
+
   ASSERT_TRUE(map.parse("--host=http://github.com -p 25 -v -d", true));
 
   ASSERT_EQ(map["host"].as_string(), "http://github.com");
@@ -102,13 +114,120 @@ TEST_F(tests_yacl, argc_argv_converter) {
   }
 }
 
+TEST_F(tests_yacl, convert_quoted) {
+  std::string s_argv = R"(--path="/tmp/my dir" 'it'\''s' a\ b "x\"y\\z\n" "" -- -v)";
+
+  int argc;
+  char **argv;
+  yacl::convert(s_argv) >> argc >> argv;
+
+  ASSERT_EQ(argc, 7);
+  ASSERT_EQ(std::string(argv[0]), "--path=/tmp/my dir");
+  ASSERT_EQ(std::string(argv[1]), "it's");
+  ASSERT_EQ(std::string(argv[2]), "a b");
+  ASSERT_EQ(std::string(argv[3]), "x\"y\\z\\n");
+  ASSERT_EQ(std::string(argv[4]), "");
+  ASSERT_EQ(std::string(argv[5]), "--");
+  ASSERT_EQ(std::string(argv[6]), "-v");
+  delete[] reinterpret_cast<char*>(argv);
+
+  yacl::convert words(s_argv);
+  ASSERT_EQ(words.size(), 7u);
+  ASSERT_EQ(std::string(words.token(2)), "a b");
+  ASSERT_EQ(words.words(5), std::string("--\0-v\0", 6));
+
+  ASSERT_THROW(yacl::convert("--path='/tmp"), std::domain_error);
+  ASSERT_THROW(yacl::convert("--path=\"/tmp"), std::domain_error);
+  ASSERT_THROW(yacl::convert("--path=/tmp\\"), std::domain_error);
+
+  yacl::map map;
+  map["path"].opt<std::string>("p", "a path", "");
+  map["v"].opt<bool>("v", "verbose", false);
+
+  ASSERT_TRUE(map.parse(s_argv, true));
+  ASSERT_EQ(map["path"].as<std::string>(), "/tmp/my dir");
+  ASSERT_EQ(map["v"].as<bool>(), false);
+}
+
 TEST_F(tests_yacl, simple_iterator) {
 
-  std::string s_argv = "--op1=123 positional_1 -v positional_2 -h --op2=str positional_3" ;
+  std::string s_argv = "--op1=123 positional_1 -v positional_2 -h --op2=str positional_3 -- -x" ;
+
+  int argc;
+  char **argv;
+  yacl::convert(s_argv) >> argc >> argv;
+
+  std::vector<yacl::argument> args;
+  for (auto arg : yacl::parse(argc, argv, false)) {
+    args.push_back(arg);
+  }
 
-//  for (auto arg : yacl::parse(argc,argv)) {
-//
-//  }
+  ASSERT_EQ(args.size(), 9u);
+
+  ASSERT_EQ(args[0].kind(), yacl::argument::LONG_OPTION);
+  ASSERT_EQ(args[0].name(), "op1");
+  ASSERT_EQ(args[0].value(), "123");
+  ASSERT_EQ(args[0].position(), 0u);
+
+  ASSERT_EQ(args[1].kind(), yacl::argument::POSITIONAL);
+  ASSERT_EQ(args[1].value(), "positional_1");
+
+  ASSERT_EQ(args[2].kind(), yacl::argument::SHORT_OPTION);
+  ASSERT_EQ(args[2].name(), "v");
+  ASSERT_FALSE(args[2].has_value());
+
+  ASSERT_EQ(args[5].name(), "op2");
+  ASSERT_EQ(args[5].value(), "str");
+  ASSERT_EQ(args[6].position(), 6u);
+
+  ASSERT_EQ(args[7].kind(), yacl::argument::SEPARATOR);
+  ASSERT_EQ(args[8].kind(), yacl::argument::POSITIONAL);
+  ASSERT_EQ(args[8].value(), "-x");
+
+  std::stringstream ss;
+  ss << args[5];
+  ASSERT_EQ(ss.str(), "--op2=str");
+
+  // argv[0] is skipped by default
+  ASSERT_EQ(yacl::parse(argc, argv).begin()->position(), 1u);
+  ASSERT_TRUE(yacl::parse(1, argv).empty());
+}
+
+TEST_F(tests_yacl, fixed_map_parse) {
+  yacl::arg_view host("localhost", 9);
+  int port = 80;
+  double ratio = 1.0;
+  bool verbose = false;
+  bool extra = false;
+
+  yacl::fixed_map<4> map;
+  ASSERT_EQ(map.req("host", 'h', host, "the remote host name"), yacl::PARSE_OK);
+  ASSERT_EQ(map.opt("port", 'p', port, "the remote host port"), yacl::PARSE_OK);
+  ASSERT_EQ(map.opt("ratio", 0, ratio, "the sampling ratio"), yacl::PARSE_OK);
+  ASSERT_EQ(map.opt("verbose", 'p', verbose, "verbose"), yacl::PARSE_DUPLICATE_OPTION);
+  ASSERT_EQ(map.opt("verbose", 'v', verbose, "verbose"), yacl::PARSE_OK);
+  ASSERT_EQ(map.opt("extra", 'x', extra, "extra"), yacl::PARSE_CAPACITY_EXCEEDED);
+
+  const char* argv[] = {"prog", "--host=github.com", "-vp", "25", "--ratio", "0.5", "--user=me", "--", "-x"};
+  ASSERT_EQ(map.parse(9, argv), yacl::PARSE_OK);
+  ASSERT_EQ(host, "github.com");
+  ASSERT_EQ(port, 25);
+  ASSERT_EQ(ratio, 0.5);
+  ASSERT_TRUE(verbose);
+  ASSERT_TRUE(map.enabled("port"));
+  ASSERT_EQ(map.ignored(), 1u);
+
+  const char* invalid[] = {"prog", "-hgithub.com", "-p80x"};
+  ASSERT_EQ(map.parse(3, invalid), yacl::PARSE_INVALID_VALUE);
+  ASSERT_EQ(map.error(), "80x");
+
+  const char* missing[] = {"prog", "--port"};
+  ASSERT_EQ(map.parse(2, missing), yacl::PARSE_MISSING_VALUE);
+
+  const char* required[] = {"prog", "-p", "8080"};
+  ASSERT_EQ(map.parse(3, required), yacl::PARSE_MISSING_REQUIRED);
+  ASSERT_EQ(map.error(), "host");
+  ASSERT_EQ(port, 8080);
 }
 
 TEST_F(tests_yacl, map_empty_assert) {
@@ -121,5 +240,494 @@ TEST_F(tests_yacl, map_empty_assert) {
   ASSERT_THROW(map.opt<int>("y", "y", 0), std::domain_error);
 }
 
+TEST_F(tests_yacl, filter_lower_case) {
+  yacl::filters::lower_case lower;
+
+  ASSERT_EQ(lower("HOST"), "host");
+  ASSERT_EQ(lower("--Remote-Host=GitHub.COM"), "--remote-host=github.com");
+  ASSERT_EQ(lower("ABCDEFGHIJKLMNOPQRSTUVWXYZ@[`{0123456789"),
+            "abcdefghijklmnopqrstuvwxyz@[`{0123456789");
+  ASSERT_EQ(lower(""), "");
+}
+
+TEST_F(tests_yacl, map_case_insensitive) {
+  yacl::map map;
+
+  map["Host"].req<std::string>("h", "the remote host name");
+  map.set_case_insensitive(true);
+  map["port"].opt<int>("p", "the remote host port", 80);
+
+  ASSERT_EQ(map["HOST"].help(), "the remote host name");
+  ASSERT_EQ(map.size(), 2);
+
+  ASSERT_TRUE(map.parse("--HOST=github.com --Port=25", true));
+
+  ASSERT_EQ(map["host"].as_string(), "github.com");
+  ASSERT_EQ(map["PORT"].as_string(), "25");
+
+  map.set_case_insensitive(false);
+  ASSERT_EQ(map["Host"].help(), "the remote host name");
+  ASSERT_EQ(map.size(), 2);
+
+  yacl::map clash;
+  clash["Host"].req<std::string>("h", "the remote host name");
+  clash["host"].opt<std::string>("o", "another host", "localhost");
+  ASSERT_THROW(clash.set_case_insensitive(true), std::domain_error);
+  ASSERT_FALSE(clash.get_case_insensitive());
+  ASSERT_EQ(clash.size(), 2);
+}
+
+TEST_F(tests_yacl, map_constraints) {
+  yacl::map map;
+
+  map["x"].opt<bool>("x", "x", false);
+  map["y"].opt<bool>("y", "y", false);
+  map["in"].opt<std::string>("i", "input", "");
+  map["out"].opt<std::string>("o", "output", "");
+  map["log"].opt<std::string>("l", "log file", "");
+  map["verbose"].opt<bool>("v", "verbose", false);
+
+  yacl::exclude(map["x"], map["y"]);
+  yacl::include(map["in"], map["out"]);
+  yacl::depends(map["log"], map["verbose"]);
+  yacl::at_least_one(map["x"], map["y"], map["in"]);
+
+  yacl::map ok(map);
+  ASSERT_TRUE(ok.parse("-x --in=a --out=b", true));
+
+  yacl::map none;
+  none["x"].opt<bool>("x", "x", false);
+  none["y"].opt<bool>("y", "y", false);
+  yacl::at_least_one(none["x"], none["y"]);
+  ASSERT_THROW(none.parse("", true), std::domain_error);
+
+  yacl::map both;
+  both["x"].opt<bool>("x", "x", false);
+  both["y"].opt<bool>("y", "y", false);
+  yacl::exclude(both["x"], both["y"]);
+  ASSERT_THROW(both.parse("-x -y", true), std::domain_error);
+  ASSERT_TRUE(both.parse("-x", true));
+  ASSERT_TRUE(both.parse("-y", true));
+  ASSERT_FALSE(both["x"].as<bool>());
+  ASSERT_TRUE(both["y"].as<bool>());
+
+  yacl::map half;
+  half["in"].opt<std::string>("i", "input", "");
+  half["out"].opt<std::string>("o", "output", "");
+  yacl::include(half["in"], half["out"]);
+  ASSERT_THROW(half.parse("--in=a", true), std::domain_error);
+
+  yacl::map dep;
+  dep["log"].opt<std::string>("l", "log file", "");
+  dep["verbose"].opt<bool>("v", "verbose", false);
+  yacl::depends(dep["log"], dep["verbose"]);
+  ASSERT_THROW(dep.parse("--log=a.txt", true), std::domain_error);
+  ASSERT_TRUE(dep.parse("-v", true));
+
+  yacl::map other;
+  ASSERT_THROW(yacl::exclude(map["x"], other["x"]), std::domain_error);
+}
+
+TEST_F(tests_yacl, map_required_missing) {
+  yacl::map map;
+
+  map["host"].req<std::string>("h", "the remote host name");
+  map["port"].opt<int>("p", "the remote host port", 80);
+
+  ASSERT_THROW(map.parse("--port=25", true), std::domain_error);
+  ASSERT_EQ(map["port"].as_string(), "");
+  ASSERT_EQ(map["port"].as<int>(), 80);
+  ASSERT_TRUE(map.parse("--host=github.com", true));
+
+  map["shoot"]["x"].req<int>("x", "required by the shoot command only");
+  ASSERT_TRUE(map.parse("--host=github.com", true));
+  ASSERT_THROW(map["shoot"].parse("", true), std::domain_error);
+  ASSERT_TRUE(map["shoot"].parse("-x 1", true));
+}
+
+TEST_F(tests_yacl, getopt_long_compatibility) {
+  static int verbose = 0;
+  static const struct option options[] = {
+      {"verbose", no_argument, &verbose, 1},
+      {"output", required_argument, nullptr, 'o'},
+      {"level", optional_argument, nullptr, 'l'},
+      {nullptr, 0, nullptr, 0}
+  };
+
+  int argc;
+  char **argv;
+  yacl::convert("prog in1 -a --verb --out result.txt in2 -ob.txt --level=3 -- -x") >> argc >> argv;
+
+  std::string seen;
+  int c, index;
+  optind = 0;
+  opterr = 0;
+  while ((c = yacl_getopt_long(argc, argv, "ao:l::", options, &index)) != -1) {
+    seen += std::string(1, c ? c : '0');
+    if (optarg) seen += "[" + std::string(optarg) + "]";
+  }
+
+  ASSERT_EQ(seen, "a0o[result.txt]o[b.txt]l[3]");
+  ASSERT_EQ(verbose, 1);
+
+  // non-options are permuted after the options, '--' is consumed
+  ASSERT_EQ(optind, 8);
+  ASSERT_EQ(std::string(argv[optind]), "in1");
+  ASSERT_EQ(std::string(argv[optind + 1]), "in2");
+  ASSERT_EQ(std::string(argv[optind + 2]), "-x");
+
+  yacl::convert("prog --output -z --lev") >> argc >> argv;
+  optind = 0;
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "+:ao:", options, &index), 'o');
+  ASSERT_EQ(std::string(optarg), "-z");
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "+:ao:", options, &index), 'l');
+  ASSERT_EQ(optarg, nullptr);
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "+:ao:", options, &index), -1);
+
+  yacl::convert("prog -o") >> argc >> argv;
+  optind = 0;
+  ASSERT_EQ(yacl_getopt_long(argc, argv, ":ao:", options, &index), ':');
+  ASSERT_EQ(optopt, 'o');
+
+  // the same buffer refilled with other names
+  struct option reused[] = {
+      {"alpha", no_argument, nullptr, 'a'},
+      {nullptr, 0, nullptr, 0}
+  };
+  yacl::convert("prog --alpha") >> argc >> argv;
+  optind = 0;
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "", reused, &index), 'a');
+
+  reused[0] = {"beta", no_argument, nullptr, 'b'};
+  yacl::convert("prog --beta") >> argc >> argv;
+  optind = 0;
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "", reused, &index), 'b');
+
+  // GNU extension: with "W;" in the optstring, '-W foo' reads as '--foo'
+  verbose = 0;
+  yacl::convert("prog -W verbose -Woutput=x.txt -W out y.txt -Wlev -Wbogus -W") >> argc >> argv;
+  optind = 0;
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "aW;", options, &index), 0);
+  ASSERT_EQ(verbose, 1);
+  ASSERT_EQ(optind, 3);
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "aW;", options, &index), 'o');
+  ASSERT_EQ(std::string(optarg), "x.txt");
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "aW;", options, &index), 'o');
+  ASSERT_EQ(std::string(optarg), "y.txt");
+  ASSERT_EQ(optind, 7);
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "aW;", options, &index), 'l');
+  ASSERT_EQ(optarg, nullptr);
+  ASSERT_EQ(yacl_getopt_long(argc, argv, "aW;", options, &index), '?');
+  ASSERT_EQ(optopt, 0);
+  ASSERT_EQ(optind, 9);
+  ASSERT_EQ(yacl_getopt_long(argc, argv, ":aW;", options, &index), ':');
+  ASSERT_EQ(optopt, 'W');
+  ASSERT_EQ(yacl_getopt_long(argc, argv, ":aW;", options, &index), -1);
+
+  // without a long option table, -W stays a plain short option
+  yacl::convert("prog -Wverbose") >> argc >> argv;
+  optind = 0;
+  ASSERT_EQ(yacl_getopt(argc, argv, "W;"), 'W');
+}
+
+TEST_F(tests_yacl, map_reparse) {
+  yacl::map map;
+
+  map["host"].opt<std::string>("h", "the remote host name", "localhost");
+  map["port"].opt<int>("p", "the remote host port", 80);
+  map["v"].opt<bool>("v", "verbose", false);
+
+  std::vector<std::string> ports;
+  map["port"].add_reader([&ports](const std::string& v) { ports.push_back(v); });
+
+  ASSERT_TRUE(map.parse("--host=github.com -p 25", true));
+  ASSERT_EQ(map["port"].as<int>(), 25);
+  ASSERT_EQ(ports.size(), 1u);
+
+  yacl::diff d = map.reparse("--host=github.com -p 25", true);
+  ASSERT_TRUE(d.empty());
+
+  d = map.reparse("--host=github.com --port=8080 -v", true);
+  ASSERT_TRUE(d.removed.empty());
+  ASSERT_EQ(d.changed, std::vector<std::string>({"port"}));
+  ASSERT_EQ(d.added, std::vector<std::string>({"v"}));
+  ASSERT_EQ(map["port"].as<int>(), 8080);
+  ASSERT_EQ(map["v"].as<bool>(), true);
+  ASSERT_EQ(ports, std::vector<std::string>({"25", "8080"}));
+
+  d = map.reparse("--port=8080 -v", true);
+  ASSERT_EQ(d.removed, std::vector<std::string>({"host"}));
+  ASSERT_TRUE(d.added.empty());
+  ASSERT_TRUE(d.changed.empty());
+  ASSERT_EQ(map["host"].as<std::string>(), "localhost");
+  ASSERT_EQ(map["host"].as_string(), "");
+  ASSERT_EQ(ports.size(), 2u);
+
+  // a rejected command line leaves the previous state untouched
+  ASSERT_THROW(map.reparse("--port=abc", true), yacl::validation_error);
+  ASSERT_THROW(map.reparse("--port=abc", true), yacl::validation_error);
+  ASSERT_EQ(map["port"].as_string(), "8080");
+  ASSERT_EQ(map["port"].as<int>(), 8080);
+  ASSERT_EQ(map["v"].as<bool>(), true);
+
+  map["out"].opt<std::string>("o", "output", "");
+  yacl::depends(map["out"], map["host"]);
+  ASSERT_THROW(map.reparse("--port=9090 -o a.txt", true), std::domain_error);
+  ASSERT_EQ(map["port"].as<int>(), 8080);
+  ASSERT_EQ(map["out"].as_string(), "");
+  ASSERT_EQ(map["v"].as<bool>(), true);
+  ASSERT_EQ(ports.size(), 2u);
+
+  d = map.reparse("--port=9090 -v", true);
+  ASSERT_EQ(d.changed, std::vector<std::string>({"port"}));
+  ASSERT_EQ(map["port"].as<int>(), 9090);
+
+  // a flag reads "" when given, removal is reported apart
+  std::vector<std::string> flags;
+  int removals = 0;
+  map["v"].add_reader([&flags](const std::string& v) { flags.push_back(v); });
+  map["v"].add_remover([&removals]() { ++removals; });
+  ASSERT_EQ(map.reparse("--port=9090", true).removed, std::vector<std::string>({"v"}));
+  ASSERT_EQ(map.reparse("--port=9090 -v", true).added, std::vector<std::string>({"v"}));
+  ASSERT_EQ(flags, std::vector<std::string>({""}));
+  ASSERT_EQ(removals, 1);
+
+  // the warnings are those of the last command line only
+  for (int i = 0; i < 3; ++i)
+    map.reparse(i % 2 ? "--port=9090 -v --unknown=1" : "--port=9090 --unknown=1", true);
+  ASSERT_EQ(map.get_warnings().size(), 1u);
+  ASSERT_THROW(map.reparse("--port=abc --other=1", true), yacl::validation_error);
+  ASSERT_EQ(map.get_warnings(), std::vector<std::string>({"Option [--unknown=1] is ignored"}));
+
+  // without a successful parse, the command line is checked in full
+  yacl::map fresh;
+  fresh["host"].req<std::string>("h", "the remote host name");
+  ASSERT_THROW(fresh.reparse("", true), std::domain_error);
+  ASSERT_THROW(fresh.parse("", true), std::domain_error);
+  ASSERT_THROW(fresh.reparse("", true), std::domain_error);
+  ASSERT_TRUE(fresh.parse("-h a", true));
+  fresh["port"].req<int>("p", "the remote host port");
+  ASSERT_THROW(fresh.reparse("-h a", true), std::domain_error);
+}
+
+TEST_F(tests_yacl, map_file_exist) {
+  yacl::map map;
+
+  map["dir"].req<std::string>("d", "a directory", yacl::file_exist<std::string>(yacl::DIRECTORY));
+  map["in"].req<std::string>("i", "an input file", yacl::file_exist<std::string>(yacl::REGULAR_FILE));
+
+  ASSERT_THROW(map.parse("--dir=. --in=.", true), yacl::validation_error);
+  ASSERT_THROW(map.parse("--dir=./yacl_no_such_directory --in=.", true), std::domain_error);
+  ASSERT_TRUE(yacl::file_check(".", yacl::ANY_FILE));
+
+  // the same checks, stat'ed in one batch on the validation threads
+  map.set_validation_threads(4);
+  map["extra"].req<std::string>("e", "another input file", yacl::file_exist<std::string>(yacl::REGULAR_FILE));
+  ASSERT_TRUE(map.parse("--dir=. --in=yacl.hpp --extra=yacl_impl.hpp", true));
+  ASSERT_EQ(map["extra"].as<std::string>(), "yacl_impl.hpp");
+  ASSERT_THROW(map.parse("--dir=yacl.hpp --in=yacl.hpp --extra=.", true), yacl::validation_error);
+  ASSERT_TRUE(map.parse("--dir=test --in=yacl.hpp --extra=yacl.hpp", true));
+  ASSERT_EQ(map["dir"].as<std::string>(), "test");
+}
+
+TEST_F(tests_yacl, thread_pool) {
+  yacl::thread_pool pool(4);
+  ASSERT_EQ(pool.size(), 4u);
+
+  // the same workers serve batch after batch
+  for (int batch = 0; batch < 20; ++batch) {
+    std::vector<int> done(100);
+    pool.run(done.size(), [&](std::size_t i) { done[i] += 1; });
+    ASSERT_EQ(std::count(done.begin(), done.end(), 1), 100);
+  }
+
+  std::vector<int> ran(10);
+  ASSERT_THROW(pool.run(ran.size(), [&](std::size_t i) {
+    ran[i] = 1;
+    if (i == 3)
+      throw std::runtime_error("task 3");
+  }), std::runtime_error);
+  ASSERT_EQ(std::count(ran.begin(), ran.end(), 1), 10);
+}
+
+TEST_F(tests_yacl, map_parallel_validation) {
+  yacl::map map;
+  std::string cmdline;
+
+  for (int i = 0; i < 200; ++i) {
+    std::string name = "opt" + std::to_string(i);
+    map[name].req<int>("", "even numbers only", [](const std::string& s) {
+      int v = std::stoi(s);
+      if (v % 2)
+        throw std::domain_error("odd value");
+      return v;
+    });
+    cmdline += " --" + name + "=" + std::to_string(i == 150 || i == 20 ? 2 * i + 1 : 2 * i);
+  }
+
+  map.set_validation_threads(4);
+
+  try {
+    map.parse(cmdline, true);
+    FAIL() << "odd values accepted";
+  } catch (const yacl::validation_error& e) {
+    ASSERT_EQ(e.errors().size(), 2u);
+    ASSERT_EQ(e.errors()[0], "Option [opt20] rejects [41]: odd value");
+    ASSERT_EQ(e.errors()[1], "Option [opt150] rejects [301]: odd value");
+  }
+
+  ASSERT_EQ(map["opt42"].as_string(), "");
+
+  // other exceptions reach the caller from any thread
+  struct not_an_error {};
+  map["opt7"].req<int>("", "throws", [](const std::string&) -> int { throw not_an_error(); });
+  ASSERT_THROW(map.parse(cmdline, true), not_an_error);
+}
+
+TEST_F(tests_yacl, map_parse_cache) {
+  yacl::map map;
+  yacl::parse_cache cache(2);
+  int conversions = 0;
+
+  map["host"].opt<std::string>("h", "the remote host name", "localhost");
+  map["port"].req<int>("p", "the remote host port", [&conversions](const std::string& s) {
+    ++conversions;
+    return std::stoi(s);
+  });
+
+  std::vector<std::string> ports;
+  map["port"].add_reader([&ports](const std::string& v) { ports.push_back(v); });
+
+  ASSERT_TRUE(map.parse("--host=github.com -p 25 --user=me", cache, true));
+  ASSERT_TRUE(map.parse("--host=github.com -p 25 --user=me", cache, true));
+  ASSERT_EQ(cache.hits(), 1u);
+  ASSERT_EQ(conversions, 1);
+  ASSERT_EQ(map["port"].as<int>(), 25);
+  ASSERT_EQ(map["host"].as<std::string>(), "github.com");
+  ASSERT_EQ(ports, std::vector<std::string>({"25", "25"}));
+
+  ASSERT_TRUE(map.parse("-p 8080", cache, true));
+  ASSERT_EQ(map["host"].as<std::string>(), "localhost");
+  ASSERT_TRUE(map.parse("--host=github.com -p 25 --user=me", cache, true));
+  ASSERT_EQ(map["port"].as<int>(), 25);
+  ASSERT_EQ(map["host"].as<std::string>(), "github.com");
+  ASSERT_EQ(conversions, 2);
+
+  ASSERT_THROW(map.parse("--host=github.com", cache, true), std::domain_error);
+  ASSERT_EQ(cache.size(), 2u);
+
+  map["user"].opt<std::string>("u", "the user name", "root");
+  ASSERT_TRUE(map.parse("--host=github.com -p 25 --user=me", cache, true));
+  ASSERT_EQ(conversions, 3);
+  ASSERT_EQ(map["user"].as<std::string>(), "me");
+}
+
+TEST_F(tests_yacl, map_dictionary) {
+  yacl::map map;
+
+  map["define"].opt<yacl::dictionary>("D", "preprocessor definitions", {});
+  map["host"].opt<std::string>("h", "the remote host name", "localhost");
+
+  std::string cmdline = "-DNDEBUG -D LEVEL=2 --define NAME=a=b --define=LEVEL=3 --host=a=b";
+  for (int i = 0; i < 3000; ++i)
+    cmdline += " -DGEN_" + std::to_string(i) + "=" + std::to_string(i);
+
+  ASSERT_TRUE(map.parse(cmdline, true));
+
+  yacl::dictionary defines = map["define"].as<yacl::dictionary>();
+  ASSERT_EQ(defines.size(), 3003u);
+  ASSERT_TRUE(defines.contains("NDEBUG"));
+  ASSERT_EQ(defines.at("NDEBUG"), "");
+  ASSERT_EQ(defines.get<int>("LEVEL"), 3);
+  ASSERT_EQ(defines.at("NAME"), "a=b");
+  ASSERT_EQ(defines.get<int>("GEN_2999"), 2999);
+  ASSERT_EQ(defines.get<int>("MISSING", 7), 7);
+  ASSERT_THROW(defines.at("MISSING"), std::domain_error);
+  ASSERT_EQ(defines.begin()->first, "NDEBUG");
+  ASSERT_EQ(map["host"].as<std::string>(), "a=b");
+  ASSERT_EQ(map["define"].as_string(), "GEN_2999=2999");
+
+  // values may hold any character, newlines included
+  char msg[] = "-DMSG=line1\nline2";
+  char x[] = "-DX=1";
+  char* argv[] = {msg, x};
+  ASSERT_TRUE(map.parse(2, argv, true));
+  defines = map["define"].as<yacl::dictionary>();
+  ASSERT_EQ(defines.size(), 2u);
+  ASSERT_EQ(defines.at("MSG"), "line1\nline2");
+  ASSERT_EQ(defines.at("X"), "1");
+
+  ASSERT_TRUE(map.reparse("-DX=1 -DY=2", true).changed == std::vector<std::string>({"define"}));
+  ASSERT_EQ(map["define"].as<yacl::dictionary>().size(), 2u);
+  ASSERT_TRUE(map.reparse("-DX=1 -DY=2", true).empty());
+  ASSERT_TRUE(map.reparse("-DX=1 -DY=3", true).changed == std::vector<std::string>({"define"}));
+  ASSERT_EQ(map["define"].as<yacl::dictionary>().get<int>("Y"), 3);
+  ASSERT_THROW(map.reparse("-DX=1 -D=3", true), yacl::validation_error);
+  ASSERT_EQ(map["define"].as<yacl::dictionary>().get<int>("Y"), 3);
+
+  ASSERT_THROW(map.parse("--define", true), std::domain_error);
+}
+
+TEST_F(tests_yacl, map_environment) {
+  yacl::map map;
+
+  map["host"].opt<std::string>("h", "the remote host name", "localhost");
+  map["port"].req<int>("p", "the remote host port");
+  map["remote-user"].opt<std::string>("u", "the remote user", "root");
+  map["port"].env("YACL_TEST_PORT");
+  map.env_prefix("YACL_TEST_APP_");
+
+  std::vector<std::string> ports;
+  map["port"].add_reader([&ports](const std::string& v) { ports.push_back(v); });
+
+  setenv("YACL_TEST_PORT", "1", 1);
+  setenv("YACL_TEST_APP_PORT", "8080", 1);
+  setenv("YACL_TEST_APP_REMOTE_USER", "admin", 1);
+  setenv("YACL_TEST_APP_HOST", "github.com", 1);
+
+  ASSERT_TRUE(map.parse("--host=example.com", true));
+  ASSERT_EQ(map["host"].as<std::string>(), "example.com");
+  ASSERT_EQ(map["port"].as<int>(), 1);
+  ASSERT_EQ(ports, std::vector<std::string>({"1"}));
+  ASSERT_EQ(map["remote-user"].as<std::string>(), "admin");
+
+  yacl::parse_cache cache;
+  ASSERT_TRUE(map.parse("", cache, true));
+  ASSERT_EQ(map["host"].as<std::string>(), "github.com");
+
+  unsetenv("YACL_TEST_APP_HOST");
+  setenv("YACL_TEST_PORT", "2", 1);
+  ASSERT_TRUE(map.parse("", cache, true));
+  ASSERT_EQ(cache.hits(), 0u);
+  ASSERT_EQ(map["host"].as<std::string>(), "localhost");
+  ASSERT_EQ(map["port"].as<int>(), 2);
+
+  // the port is bound to its own variable only
+  unsetenv("YACL_TEST_PORT");
+  ASSERT_THROW(map.parse("", cache, true), std::domain_error);
+
+  unsetenv("YACL_TEST_APP_PORT");
+  unsetenv("YACL_TEST_APP_REMOTE_USER");
+
+  // reparse reads the environment again
+  yacl::map rp;
+  rp["port"].opt<int>("p", "the remote host port", 80);
+  rp["port"].env("YACL_TEST_RP_PORT");
+
+  setenv("YACL_TEST_RP_PORT", "1", 1);
+  ASSERT_TRUE(rp.parse("", true));
+  ASSERT_EQ(rp["port"].as<int>(), 1);
+
+  setenv("YACL_TEST_RP_PORT", "2", 1);
+  yacl::diff d = rp.reparse("", true);
+  ASSERT_EQ(d.changed, std::vector<std::string>({"port"}));
+  ASSERT_EQ(rp["port"].as<int>(), 2);
+  ASSERT_TRUE(rp.reparse("", true).empty());
+
+  unsetenv("YACL_TEST_RP_PORT");
+  ASSERT_EQ(rp.reparse("", true).removed, std::vector<std::string>({"port"}));
+  ASSERT_EQ(rp["port"].as<int>(), 80);
+}
+
 }
 }
@@ -0,0 +1,16 @@
+#include "yacl.hpp"
+#include "yacl_impl.hpp"
+
+#define YACL_GETOPT_IMPLEMENTATION
+#include "yacl_getopt.h"
+
+namespace yacl {
+
+YACL_TEMPLATES(, bool)
+YACL_TEMPLATES(, int)
+YACL_TEMPLATES(, long)
+YACL_TEMPLATES(, unsigned int)
+YACL_TEMPLATES(, double)
+YACL_TEMPLATES(, std::string)
+
+}
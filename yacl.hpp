@@ -1,19 +1,44 @@
 #pragma once
 
+/**
+ * Built without exceptions or RTTI (or with YACL_EMBEDDED defined), yacl
+ * only provides its embedded configuration: see yacl_embedded.hpp.
+ */
+#if !defined(YACL_EMBEDDED) && defined(__GNUC__) && (!defined(__EXCEPTIONS) || !defined(__GXX_RTTI))
+#define YACL_EMBEDDED
+#endif
+
+#ifdef YACL_EMBEDDED
+#include "yacl_embedded.hpp"
+#else
+
 #include <string>
 #include <ostream>
 #include <vector>
+#include <deque>
 #include <functional>
-#include <map>
 #include <unordered_map>
 #include <memory>
 #include <stdexcept>
 #include <algorithm>
 #include <sstream>
-#include <deque>
-#include <cctype>
-#include <clocale>
 #include <type_traits>
+#include <typeinfo>
+#include <iterator>
+
+#include "yacl_arguments.hpp"
+
+/**
+ * yacl is header-only by default. Defining YACL_LIBRARY (the 'yacl'
+ * CMake target does it for its users) turns the non-template code into
+ * declarations compiled once in yacl.cpp, and the common Option<T>
+ * instantiations into extern templates.
+ */
+#ifdef YACL_LIBRARY
+#define YACL_INLINE
+#else
+#define YACL_INLINE inline
+#endif
 
 namespace yacl {
 
@@ -30,7 +55,7 @@ class BData {
     return bdata_ != nullptr;
   }
 
-  const std::type_info &type_info() const throw(std::bad_typeid) {
+  const std::type_info &type_info() const {
     if (!is_setted())
       throw std::bad_typeid();
 
@@ -54,7 +79,7 @@ class BData {
   }
 
   template<typename T>
-  const T &get_data() const throw(std::logic_error, std::bad_cast) {
+  const T &get_data() const {
     if (!is_setted()) {
       throw std::logic_error("No data are available");
     }
@@ -107,58 +132,67 @@ typedef struct {} file;
 class convert {
   typedef char** type_argv;
   int argc_;
-  type_argv argv_;
+  type_argv argv_ = nullptr;
   std::string s_argv_;
+  // the words of a command string, each one NUL terminated
+  std::string buffer_;
+  std::vector<std::size_t> offsets_;
+  // built on request only
   std::vector<std::string> v_argv_;
 
- public:
+  /**
+   * Single pass POSIX shell word splitting: blanks separate the words,
+   * single quotes keep everything literal, double quotes keep everything
+   * but the \$ \` \" \\ escapes, and elsewhere a backslash escapes the
+   * next character. The words are written into buffer, each one NUL
+   * terminated, and offsets receives where they start.
+   */
+  static void tokenize(const std::string& s, std::string& buffer, std::vector<std::size_t>& offsets);
 
-  convert(int argc, type_argv argv)
-      : argc_(argc)
-      , argv_(argv)
-      , v_argv_(argv, argv + argc)
-  {
-    if (argc < 1)
-      return;
+  /**
+   * Length of the prefix of [first, last) without any of the n specials.
+   */
+  static std::size_t plain(const char* first, const char* last, const char* specials, std::size_t n);
 
-    s_argv_ = std::string(argv[0]);
-    for (auto&s : std::vector<std::string>(argv+1, argv + argc))
-      s_argv_ += " " + s;
-  }
+  type_argv materialize() const;
 
-  convert(std::string s_argv)
-      : s_argv_(s_argv)
-  {
-    std::stringstream ss;
-    std::string s_tmp;
+  const std::vector<std::string>& strings();
 
-    ss << s_argv_;
-    while (ss >> s_tmp) {
-      v_argv_.push_back(s_tmp);
-    }
+  /**
+   * The words joined with blanks: the command string, or argv joined on
+   * the first request.
+   */
+  const std::string& line();
 
-    argc_ = v_argv_.size();
-    if (argc_ == 0) {
-      argv_ = nullptr;
-      return;
-    }
+ public:
 
-    argv_ = new char*[argc_];
-    char** it = argv_;
+  convert(int argc, type_argv argv);
 
-    for (auto&s : v_argv_) {
-      char *i = new char[s.length() + 1];
-      std::copy(s.begin(), s.end(), i);
-      i[s.length()] = '\0';
-      *it++ = i;
-    }
+  /**
+   * Splits a command string the way a POSIX shell does (see tokenize),
+   * throws std::domain_error on an unterminated quote or escape.
+   */
+  convert(std::string s_argv);
+
+  std::size_t size() const { return argc_ > 0 ? argc_ : 0; }
+
+  /**
+   * The i-th word, NUL terminated, without copying it.
+   */
+  const char* token(std::size_t i) const {
+    return offsets_.empty() ? argv_[i] : buffer_.data() + offsets_[i];
   }
 
-  auto begin() -> decltype(v_argv_.begin()) { return v_argv_.begin(); }
-  auto end() -> decltype(v_argv_.end()) { return v_argv_.end(); }
+  /**
+   * The words from first on in a single string, each one NUL terminated.
+   */
+  std::string words(std::size_t first) const;
+
+  auto begin() -> decltype(v_argv_.cbegin()) { return strings().cbegin(); }
+  auto end() -> decltype(v_argv_.cend()) { return strings().cend(); }
 
   convert& operator>>(std::string& s) {
-    s = std::string(s_argv_);
+    s = line();
     return *this;
   }
 
@@ -167,7 +201,14 @@ class convert {
     return *this;
   }
 
+  /**
+   * For a command string, argv is built on the first request as a single
+   * block (the pointers, then the words) owned by the caller:
+   * delete[] reinterpret_cast<char*>(argv).
+   */
   convert& operator>>(type_argv& argv) {
+    if (!argv_ && argc_ > 0)
+      argv_ = materialize();
     argv = argv_;
     return *this;
   }
@@ -187,9 +228,77 @@ struct range {
   T operator()(T data) { return (begin <= data && data <= end); }
 };
 
+enum file_type {
+  ANY_FILE,
+  REGULAR_FILE,
+  DIRECTORY
+};
+
+/**
+ * True if path exists and is of the given type.
+ */
+bool file_check(const std::string& path, file_type type);
+
 template <class T>
 struct file_exist {
-  T operator()(T data) { return true; }
+  file_type type;
+  file_exist(file_type type = ANY_FILE) : type(type) {}
+
+  T operator()(T data) {
+    if (!file_check(data, type))
+      throw std::domain_error("The file [" + std::string(data) + "] does not exist");
+    return data;
+  }
+};
+
+/**
+ * True for the filters whose values are checked against the file system,
+ * so that validation can stat them all up front (see file_batch).
+ */
+template <class F>
+struct is_file_filter : std::false_type {};
+
+template <class T>
+struct is_file_filter<file_exist<T>> : std::true_type {};
+
+/**
+ * The types of the files named by a batch of option values. Validation
+ * stats them together on its threads before running the filters, and
+ * file_check() reads the batch current on its thread instead of calling
+ * stat() again.
+ */
+class file_batch {
+ public:
+  enum { MISSING = -1, UNKNOWN = -2 };
+
+  void add(const std::string& path);
+  std::size_t size() const { return paths.size(); }
+
+  /**
+   * Stats the i-th path; distinct paths may be loaded concurrently.
+   */
+  void load(std::size_t i) { kinds[i] = kind_of(paths[i]); }
+
+  /**
+   * MISSING, the file_type of path (ANY_FILE for the other kinds of
+   * files), or UNKNOWN when path is not in the batch.
+   */
+  int kind(const std::string& path) const;
+
+  /**
+   * Stats path now.
+   */
+  static int kind_of(const std::string& path);
+
+  /**
+   * The batch file_check() reads on the calling thread, nullptr for none.
+   */
+  static const file_batch*& current();
+
+ private:
+  std::unordered_map<std::string, std::size_t> index;
+  std::vector<std::string> paths;
+  std::vector<int> kinds;
 };
 
 namespace filters {
@@ -202,9 +311,16 @@ struct filter {
 struct lower_case : public filter {
   virtual std::string operator()(const std::string &v) {
     std::string lower_str(v);
-    //std::transform(v.cbegin(), v.cend(), lower_str.begin(), std::tolower);
+    fold(lower_str);
     return lower_str;
   }
+
+  /**
+   * In-place case folding: ASCII letters are folded 16 bytes at a time,
+   * as soon as a non-ASCII byte is found the rest of the string goes
+   * through std::tolower, which honours the current C locale.
+   */
+  static void fold(std::string &s);
 };
 
 }
@@ -213,13 +329,24 @@ struct lower_case : public filter {
 class OptionProgrammable {
  public:
   typedef std::function<void(const std::string &val)> reader;
+  typedef std::function<void()> remover;
 
     template <typename T>
-    OptionProgrammable add_reader(T f) {
+    OptionProgrammable& add_reader(T f) {
       readers_.push_back(f);
       return *this;
     }
 
+    /**
+     * Called when a reparse drops the option; the readers are not, since
+     * an empty raw value is also what a flag given alone (-v) reads.
+     */
+    template <typename T>
+    OptionProgrammable& add_remover(T f) {
+      removers_.push_back(f);
+      return *this;
+    }
+
     template <typename T, typename O, typename F>
     OptionProgrammable& assign_to(O o, F f) {
       assign_ = [o, f](const std::string &val) {
@@ -242,9 +369,27 @@ class OptionProgrammable {
 //    }
 
  protected:
+  /**
+   * The readers get the new raw value each time the option is set or its
+   * value changes, the removers are called when it is removed.
+   */
+  void notify(const std::string &val, bool removed) {
+    if (removed) {
+      for (auto &r : removers_)
+        r();
+      return;
+    }
+
+    for (auto &r : readers_)
+      r(val);
+    if (assign_)
+      assign_(val);
+  }
+
   std::shared_ptr<filters::filter> filter_;
   reader assign_;
   std::vector<reader> readers_;
+  std::vector<remover> removers_;
 };
 
 class OptionAbstract {
@@ -267,28 +412,185 @@ class OptionAbstract {
 
   virtual void set_type(const option_type s) = 0;
   virtual option_type get_type() = 0;
+
+  virtual void set_value(const std::string& s) = 0;
+
+  /**
+   * Copy the converted value to and from a type-erased holder, so that a
+   * parse result can be replayed without converting again (parse_cache).
+   */
+  virtual void save_value(tdata::BData& d) = 0;
+  virtual void load_value(const tdata::BData& d) = 0;
+
+  /**
+   * True if the filter looks the value up on the file system.
+   */
+  virtual bool checks_files() const { return false; }
+};
+
+/**
+ * Dynamic bitset over the dense option ids of a schema.
+ */
+class bitset {
+ public:
+  typedef unsigned long long word;
+  static const std::size_t word_bits = 64;
+
+  std::size_t size() const { return words.size() * word_bits; }
+
+  void set(std::size_t i, bool v = true) {
+    if (i / word_bits >= words.size())
+      words.resize(i / word_bits + 1, 0);
+
+    if (v) words[i / word_bits] |= (word(1) << (i % word_bits));
+    else   words[i / word_bits] &= ~(word(1) << (i % word_bits));
+  }
+
+  bool test(std::size_t i) const {
+    return i / word_bits < words.size() &&
+        (words[i / word_bits] >> (i % word_bits)) & 1;
+  }
+
+  void clear() { std::fill(words.begin(), words.end(), 0); }
+
+  std::size_t count() const {
+    std::size_t n = 0;
+    for (auto w : words) n += popcount(w);
+    return n;
+  }
+
+  static std::size_t popcount(word w) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(w);
+#else
+    std::size_t n = 0;
+    for (; w; w &= w - 1) ++n;
+    return n;
+#endif
+  }
+
+  std::vector<word> words;
+};
+
+/**
+ * Flat storage shared by every node of a map tree. Each option is a row
+ * with a dense id, its metadata and parse state live in parallel arrays
+ * and bitsets, and yacl::map is a facade over one row. The parser and the
+ * constraint checks only walk these arrays.
+ */
+class schema {
+ public:
+  enum constraint_type {
+    EXCLUDE,      // at most one of the group
+    INCLUDE,      // all of the group or none
+    DEPENDS,      // if the first option is enabled, all the others must be
+    AT_LEAST_ONE  // at least one of the group
+  };
+
+  enum : std::size_t { npos = static_cast<std::size_t>(-1) };
+
+  schema();
+  ~schema();
+
+  std::size_t size() const { return names.size(); }
+
+  /**
+   * Unique among all the schemas of the process, unlike their addresses.
+   */
+  std::size_t uid() const { return uid_; }
+
+  /**
+   * Bumped whenever an option, a short name, a type or a constraint
+   * changes, so the per-map short option indexes and the parse caches
+   * know when their data is stale.
+   */
+  std::size_t version() const { return version_; }
+
+  map& node(std::size_t id) { return *nodes[id]; }
+
+  static void add_constraint(constraint_type type, const std::vector<map*>& group);
+
+  /**
+   * Throws std::domain_error on the first missing REQUIRED option or
+   * violated constraint among the options of scope (a constraint belongs
+   * to the scope of its first option).
+   */
+  void check(const bitset& scope) const;
+
+ private:
+  friend class map;
+  friend class OptionMethod;
+
+  struct constraint {
+    constraint_type type;
+    std::size_t trigger;
+    std::size_t first_word;
+    std::vector<bitset::word> mask;
+  };
+
+  std::size_t add(const std::string& name);
+
+  std::string describe(const constraint& c) const;
+
+  // one entry per option id; the strings handed out by reference
+  // (help(), get_long_name()...) live in deques, which keep them in place
+  // when options are added
+  std::deque<std::string> names;
+  std::deque<std::string> spellings;
+  std::deque<std::string> short_names;
+  std::deque<std::string> helps;
+  std::vector<OptionAbstract::option_type> types;
+  std::vector<std::string> values;
+  std::vector<std::string> variables;
+  std::vector<std::shared_ptr<OptionAbstract>> options;
+  std::vector<std::unique_ptr<map>> nodes;
+
+  bitset enabled;
+  bitset required;
+  bitset flags;
+  bitset dictionaries;
+
+  std::vector<constraint> constraints;
+  std::size_t uid_;
+  std::size_t version_ = 0;
 };
 
+/**
+ * The metadata of an option is stored in its schema row, OptionMethod
+ * only knows which row it is bound to.
+ */
 class OptionMethod : public OptionAbstract {
  protected:
-  std::string help;
-  std::string long_name;
-  std::string short_name;
-  option_type type;
+  schema* table = nullptr;
+  std::size_t id = 0;
 
  public:
 
-  virtual void set_help(const std::string& s) { help = s; }
-  virtual std::string& get_help() { return this->help; }
+  void bind(schema* t, std::size_t i) { table = t; id = i; }
+
+  virtual void set_help(const std::string& s) { table->helps[id] = s; }
+  virtual std::string& get_help() { return table->helps[id]; }
 
-  virtual void set_long_name(const std::string& s) { long_name = s; }
-  virtual std::string& get_long_name() { return long_name; }
+  virtual void set_long_name(const std::string& s) { table->names[id] = s; }
+  virtual std::string& get_long_name() { return table->names[id]; }
+
+  virtual void set_short_name(const std::string& s) {
+    table->short_names[id] = s;
+    ++table->version_;
+  }
+  virtual std::string& get_short_name()  { return table->short_names[id]; }
+
+  virtual void set_type(const option_type s) {
+    table->types[id] = s;
+    table->required.set(id, s == REQUIRED);
+    ++table->version_;
+  }
+  virtual option_type get_type() { return table->types[id]; }
 
-  virtual void set_short_name(const std::string& s) { short_name = s; }
-  virtual std::string& get_short_name()  { return short_name; }
+  virtual void set_value(const std::string&) {}
 
-  virtual void set_type(const option_type s) { type = s; }
-  virtual option_type get_type() { return type; }
+  virtual void save_value(tdata::BData&) {}
+  virtual void load_value(const tdata::BData&) {}
 };
 
 template <class T>
@@ -313,13 +615,103 @@ class FilterStringStream : public FilterAbstract<T> {
 
 };
 
+/**
+ * A string value is taken whole, it may hold quoted blanks.
+ */
+template <>
+inline std::string FilterStringStream<std::string>::filter(const std::string &s) { return s; }
+
+/**
+ * Splits "name=value" at the first '=' of [first, last), returns false
+ * when there is none.
+ */
+bool split_assignment(std::string::const_iterator first, std::string::const_iterator last,
+                      std::string& name, std::string& value);
+
+/**
+ * The name=value pairs collected by a dictionary option, declared as
+ *   map["define"].opt<yacl::dictionary>("D", "definitions", {});
+ * and given as -Dname=value, -D name=value, --define name=value or
+ * --define=name=value. A name without value is defined as "". The raw
+ * value of the option (as_string) is its last definition.
+ *
+ * Entries are kept densely in insertion order and found through a flat
+ * open-addressing table of entry indexes (linear probing, at most half
+ * full). Defining a name again replaces its value.
+ */
+class dictionary {
+ public:
+  typedef std::pair<std::string, std::string> entry;
+  typedef std::vector<entry>::const_iterator const_iterator;
+
+  std::size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+
+  const_iterator begin() const { return entries.begin(); }
+  const_iterator end() const { return entries.end(); }
+
+  void clear();
+  void reserve(std::size_t n);
+  void set(const std::string& name, const std::string& value);
+
+  /**
+   * Sets a name=value definition, split at its first '='. Throws
+   * std::domain_error when the name is empty.
+   */
+  void define(const std::string& definition);
+
+  /**
+   * The value of name, nullptr when it is not defined.
+   */
+  const std::string* find(const std::string& name) const;
+
+  bool contains(const std::string& name) const { return find(name) != nullptr; }
+
+  /**
+   * Throws std::domain_error when name is not defined.
+   */
+  const std::string& at(const std::string& name) const;
+
+  template <class T>
+  T get(const std::string& name) const { return convert_value<T>(at(name)); }
+
+  template <class T>
+  T get(const std::string& name, const T& fallback) const {
+    const std::string* v = find(name);
+    return v ? convert_value<T>(*v) : fallback;
+  }
+
+ private:
+  template <class T>
+  static T convert_value(const std::string& s) { return FilterStringStream<T>().filter(s); }
+
+  std::size_t probe(const std::string& name, std::size_t hash) const;
+  void rehash(std::size_t capacity);
+
+  std::vector<entry> entries;
+  std::vector<std::size_t> hashes;
+  std::vector<std::size_t> slots;  // entry index + 1, 0 when free
+};
+
+/**
+ * Converts a single definition: map::validate gathers all the
+ * definitions of a dictionary option into one value.
+ */
+template <>
+dictionary FilterStringStream<dictionary>::filter(const std::string& s);
+
+
+inline bool toggle(bool v) { return !v; }
+
+template <class T>
+T toggle(const T& v) { return v; }
 
 template <class T>
 class Option: public OptionMethod, public FilterStringStream<T> {
  protected:
   std::string data;
-  T default_value;
-  T cmdline_value;
+  T default_value{};
+  T cmdline_value{};
  public:
 
   Option() {}
@@ -332,6 +724,17 @@ class Option: public OptionMethod, public FilterStringStream<T> {
   T& get_cmdline_value() { return cmdline_value; }
 
   virtual const std::string& get_data() const { return data; }
+
+  /**
+   * Converts the raw command line value into cmdline_value; a bool flag
+   * given without value (-v) toggles its default.
+   */
+  virtual void set_value(const std::string& s) {
+    cmdline_value = (s.empty() && std::is_same<T, bool>::value) ? toggle(default_value) : this->filter(s);
+  }
+
+  virtual void save_value(tdata::BData& d) { d.set_data<T>(cmdline_value); }
+  virtual void load_value(const tdata::BData& d) { cmdline_value = d.get_data<T>(); }
 };
 
 template <class T, class F>
@@ -344,6 +747,8 @@ class option_with_object_filter: public Option<T> {
     return f(s);
   }
 
+  virtual bool checks_files() const { return is_file_filter<F>::value; }
+
  private:
   F f;
 };
@@ -398,56 +803,278 @@ filter_oneof<T> oneof(T first, Args... args) {
   return filter_oneof<T>(std::vector<T>({first, args...}));
 }
 
-class map {
+/**
+ * Thrown by parse() when option values are rejected by their filters,
+ * errors() holds one message per rejected value in argument order.
+ */
+class validation_error : public std::domain_error {
+ public:
+  explicit validation_error(const std::vector<std::string>& errors)
+      : std::domain_error(join(errors)), errors_(errors) {}
+
+  const std::vector<std::string>& errors() const { return errors_; }
+
+ private:
+  static std::string join(const std::vector<std::string>& errors) {
+    std::string s;
+    for (auto& e : errors)
+      s += (s.empty() ? "" : "\n") + e;
+    return s;
+  }
+
+  std::vector<std::string> errors_;
+};
+
+/**
+ * Options that differ between two parses, see map::reparse().
+ */
+struct diff {
+  std::vector<std::string> added;
+  std::vector<std::string> removed;
+  std::vector<std::string> changed;
+
+  bool empty() const { return added.empty() && removed.empty() && changed.empty(); }
+};
+
+/**
+ * Worker threads kept from one parse to the next to run the validation
+ * tasks (see map::set_validation_threads). run() hands the tasks of a
+ * batch out to the workers and to the calling thread, and returns once
+ * they are all done; concurrent calls run one batch after the other.
+ */
+class thread_pool {
+ public:
+  explicit thread_pool(std::size_t threads);
+  ~thread_pool();
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  /**
+   * Threads running a batch, the calling one included.
+   */
+  std::size_t size() const { return size_; }
+
+  /**
+   * Calls task(0) ... task(n - 1), then rethrows one of the exceptions
+   * they threw, if any.
+   */
+  void run(std::size_t n, const std::function<void(std::size_t)>& task);
+
+ private:
+  struct shared;
+  std::size_t size_;
+  std::unique_ptr<shared> shared_;
+};
+
+/**
+ * Opt-in memoization of whole parse results, for programs parsing the
+ * same command lines over and over (see map::parse(..., parse_cache&)).
+ * Results are keyed by a hash of the command line and bound to the
+ * schema, node and schema version that produced them; beyond capacity
+ * the least recently used one is evicted. A cache can be shared by
+ * several maps and threads.
+ */
+class parse_cache {
+ public:
+  explicit parse_cache(std::size_t capacity = 4096);
+
+  std::size_t capacity() const { return capacity_; }
+  std::size_t size() const;
+  std::size_t hits() const;
+  std::size_t misses() const;
+
+  void clear();
+
+ private:
+  friend class map;
+  struct result;
+  struct store;
+
+  std::shared_ptr<const result> find(const std::string& key);
+  void insert(const std::string& key, std::shared_ptr<const result> r);
+
+  std::size_t capacity_;
+  std::shared_ptr<store> store_;
+};
+
+class map : public OptionProgrammable {
 
  private:
-  std::string description;
-  std::deque<std::string> warnings;
-  std::string value;
-  bool enabled;
+  typedef std::shared_ptr<OptionMethod> ptr_method;
+  typedef std::shared_ptr<schema> ptr_schema;
+  typedef std::vector<std::pair<std::size_t, std::string>> matches;
+  typedef std::vector<std::pair<std::size_t, tdata::BData>> snapshot;
+
+  /**
+   * What only a parsed node needs: the schema it owns when it is the
+   * root, its indexes over the children and the state of its last
+   * parse. Created on first use, so that the option nodes stay a row of
+   * the schema and their children.
+   */
+  struct context {
+    ptr_schema owner;
+
+    std::vector<std::size_t> short_index;
+    std::size_t short_version = schema::npos;
+    bitset scope_mask;
+    std::size_t scope_version = schema::npos;
+
+    std::string environment_prefix;
+    std::vector<std::pair<std::string, std::size_t>> env_index;
+    std::size_t env_version = schema::npos;
+
+    std::vector<std::string> warnings;
+    // the arguments of the last parse, each one NUL terminated
+    std::string tokens;
+    matches env_values;
+    // schema version of the last successful parse, npos when there is none
+    std::size_t parsed_version = schema::npos;
+    std::vector<std::size_t> active;
+    // every definition of the enabled dictionary options, in order
+    std::unordered_map<std::size_t, std::vector<std::string>> definitions;
+    unsigned validation_threads = 1;
+    // kept between parses, and shared by the copies of this map
+    std::shared_ptr<thread_pool> pool;
+  };
 
-  typedef std::shared_ptr<map> ptr_map;
-  typedef std::shared_ptr<OptionAbstract> ptr_option;
+  schema* table = nullptr;
+  std::size_t id = schema::npos;
+  std::unordered_map<std::string, std::size_t> children;
+  bool case_insensitive = false;
+  std::unique_ptr<context> ctx;
 
-  ptr_option single_option;
-  std::unordered_map<unsigned int, ptr_option> int_options;
-  std::unordered_map<std::string, ptr_map> multi_options;
+  map(schema* t, std::size_t i) : table(t), id(i) {}
 
-  void add(ptr_option op,
-           const std::string& long_name,
+  context& state();
+
+  void add(ptr_method op,
            const std::string short_name,
            const std::string help,
            const OptionAbstract::option_type type) {
-    op->set_long_name(description);
+    op->bind(table, id);
     op->set_short_name(short_name);
     op->set_help(help);
     op->set_type(type);
-    single_option = op;
+    table->options[id] = op;
+    table->flags.set(id, dynamic_cast<FilterAbstract<bool>*>(op.get()) != nullptr);
+    table->dictionaries.set(id, dynamic_cast<Option<dictionary>*>(op.get()) != nullptr);
   }
 
+  void enable(std::size_t option, const std::string& v);
+
+  /**
+   * Validation stage: converts the matched values through the option
+   * filters, spreading the options over the validation_threads threads
+   * of the pool. The files named by file_exist options are stat'ed first,
+   * in one batch.
+   * Throws validation_error with every rejected value, or rethrows the
+   * first exception not derived from std::exception. If saved is given,
+   * it receives the converted values as they were before, and they are
+   * restored when a value is rejected.
+   */
+  void validate(const matches& found, snapshot* saved = nullptr);
+
+  /**
+   * Notifies the readers of the matched options, in argument order.
+   */
+  void announce(const matches& found);
+
+  /**
+   * Child id for each short option character, rebuilt only when a short
+   * name of the schema changed.
+   */
+  const std::vector<std::size_t>& shorts();
+
+  /**
+   * Ids of the children, the options a parse of this node checks.
+   */
+  const bitset& scope();
+
+  std::string arguments(convert& c, bool missing_program_name, bool ignore_program_name);
+
+  /**
+   * Sorted environment variable names bound to the children, one per
+   * child at most, rebuilt only when the schema changed.
+   */
+  const std::vector<std::pair<std::string, std::size_t>>& env_names();
+
+  /**
+   * Values of the environment variables bound to the children, ordered by
+   * option, read in a single pass over environ.
+   */
+  matches environment();
+
+  /**
+   * Appends the environment values of the options missing from the
+   * command line: command line first, then environment, then defaults.
+   */
+  static void fallback(matches& found, const matches& env);
+
+  /**
+   * Tokenization and classification only: collects the options matched by
+   * the arguments, without touching their state. Each definition of a
+   * dictionary option is a match of its own.
+   */
+  void scan(const std::string& args, matches& found);
+
+  /**
+   * Converts the values of the matched options, enables them and checks
+   * the schema constraints. Nothing is left enabled when it throws.
+   */
+  void apply(const matches& found);
+
+  /**
+   * Clears what the previous parse of this map set, without notifying.
+   */
+  void reset();
+
+  /**
+   * Cache key prefix: the schema, its version, this node, the flags
+   * deciding which tokens are parsed and the environment values.
+   */
+  std::string cache_key(char source, bool missing_program_name, bool ignore_program_name,
+                        const matches& env) const;
+
+  bool replay(parse_cache& cache, const std::string& key, const matches& env);
+  bool record(parse_cache& cache, const std::string& key, convert& c, const matches& env,
+              bool missing_program_name, bool ignore_program_name);
+
+  friend class schema;
+
 //  template <class T, class P>
 //  void add(std::string long_name, std::string short_name, const T data=T(), P f=P()) {
 //  }
 
-  void check_condition() const throw(std::domain_error) {
-    if (description.empty())
+  /**
+   * The key under which an option name is stored: long names are folded
+   * once here, at registration and once per token while parsing, so the
+   * lookups themselves stay plain hash lookups.
+   */
+  std::string key(const std::string& s) const;
+
+  /**
+   * Throws std::domain_error if folding the case (v) would merge two
+   * options of this map or of its subgroups.
+   */
+  void check_fold(bool v) const;
+
+  void check_condition() const {
+    if (id == schema::npos)
       throw std::domain_error("description parameter missing");
   }
 
  public:
 
-  map()  {}
-  map(const std::string&s) :
-      description (s),
-      enabled(false),
-      single_option(new OptionMethod())
-  {}
+  map() {}
+  map(const std::string& s);
+  map(const map& m);
+  map& operator=(const map& m);
 
   template <class T>
   void req(std::string short_name, std::string help) {
     check_condition();
     add(std::make_shared<Option<T>>(),
-        description,
         short_name,
         help,
         OptionAbstract::REQUIRED);
@@ -457,7 +1084,6 @@ class map {
   void req(std::string short_name, std::string help, std::function<T(T)> filter) {
     check_condition();
     add(std::make_shared<option_with_lambda_filter<T>>(filter),
-        description,
         short_name,
         help,
         OptionAbstract::REQUIRED);
@@ -469,7 +1095,6 @@ class map {
   void req(std::string short_name, std::string help, F filter=F()) {
     check_condition();
     add(std::make_shared<option_with_object_filter<T, F>>(filter),
-        description,
         short_name,
         help,
         OptionAbstract::REQUIRED);
@@ -482,7 +1107,6 @@ class map {
     opt->set_default_value(val);
 
     add(std::move(opt),
-        description,
         short_name,
         help,
         OptionAbstract::OPTIONAL);
@@ -503,15 +1127,17 @@ class map {
     check_condition();
 
     //add check had parsed
-    Option<T> *data = dynamic_cast<Option<T>*>(single_option.get());
+    Option<T> *data = dynamic_cast<Option<T>*>(table->options[id].get());
     if (!data)
       throw std::domain_error("Conversion not allowed");
 
-    if (enabled) return data->get_cmdline_value();
+    if (table->enabled.test(id)) return data->get_cmdline_value();
 
     if (data->get_type() == OptionAbstract::REQUIRED)
       throw std::runtime_error("Required missing value");
 
+    return data->get_default_value();
+
 //    return data->filter(data->get_default_value());
 /*
     if (std::is_same<T, bool>::value)
@@ -528,11 +1154,11 @@ class map {
 
   std::string as_string() {
     check_condition();
-    return value;
+    return table->values[id];
   }
 
   int size() const {
-    return multi_options.size();
+    return children.size();
 //    +
 //        std::accumulate(multi_options.begin(), multi_options.end(),0,
 //                        [](const size_t p, const std::pair<std::string,size_t>& map) {
@@ -542,24 +1168,49 @@ class map {
 
   std::string& help() const {
     check_condition();
-    OptionMethod *data = dynamic_cast<OptionMethod*>(single_option.get());
-    return single_option->get_help();
+    return table->helps[id];
   }
 
-  map& operator[](const std::string& s) {
-    if (multi_options.find(s) != multi_options.end()) {
-      return *multi_options[s];
-    }
+  /**
+   * When enabled, long option names are matched ignoring the ASCII case:
+   * --Host, --HOST and --host all select map["host"].
+   * Short options stay case sensitive (-v and -V are different options).
+   * Throws std::domain_error when two names differ only by their case;
+   * disabling it again restores the names as they were first spelled.
+   */
+  void set_case_insensitive(bool v);
 
-    multi_options[s] = std::make_shared<map>(s);
-    return *multi_options[s];
-  }
+  /**
+   * Number of threads used to run the option filters after parsing
+   * (1 by default, 0 means one per hardware thread). Filters of distinct
+   * options may then run concurrently, so they must be thread safe.
+   */
+  void set_validation_threads(unsigned n) { state().validation_threads = n; }
 
-  map& operator[](unsigned int pos) {
-    if (int_options.find(pos) != int_options.end()) {
+  bool get_case_insensitive() const { return case_insensitive; }
 
-    }
+  /**
+   * The arguments ignored by the last parse.
+   */
+  const std::vector<std::string>& get_warnings() const;
 
+  /**
+   * Environment variable used when this option is not on the command
+   * line, ex: map["port"].env("APP_PORT").
+   */
+  map& env(const std::string& variable);
+
+  /**
+   * Binds every option of this map to the variable made of the prefix
+   * and the upper-cased option name, '-' and '.' becoming '_': with
+   * env_prefix("APP_"), APP_REMOTE_HOST sets map["remote-host"]. An
+   * option bound with env() only reads its own variable.
+   */
+  map& env_prefix(const std::string& prefix);
+
+  map& operator[](const std::string& s);
+
+  map& operator[](unsigned int) {
     return *this;
   }
 
@@ -583,123 +1234,21 @@ class map {
     return (std::count(v.begin(), v.end(), ' ') > 0);
   }
 
-  bool has_long_option(const std::string& v, std::string& opt_name, std::string& opt_val) {
-    if (!(v.length() > 1)) return false;
-    if (!(v[0] == '-' && v[1] == '-')) return false;
-    if (!(v.length() >= 5)) throw std::domain_error("Invalid argument [" + v + "]");
-    if (!((bool) std::isalpha(v[2]))) throw std::domain_error("Invalid argument [" + v + "]");
-    if (!(std::count(v.begin(), v.end(), '=') == 1)) return false;
+  bool has_long_option(const std::string& v, std::string& opt_name, std::string& opt_val);
 
-    auto eq_pos = std::find(v.begin(), v.end(), '=');
-    if (!(eq_pos != v.end()-1)) throw std::domain_error("Incomplete argument [" +  v + "]");
+  bool has_single_short_option(const std::string& v, std::string& opt_name);
 
-    opt_name = std::string(v.begin()+2, eq_pos);
-    opt_val = std::string(eq_pos+1, v.end());
-
-    return true;
-  }
-
-  bool has_single_short_option(const std::string& v, std::string& opt_name) {
-    if (!(v.length() == 2)) return false;
-    if (!(v[0] == '-')) return false;
-    if (!((bool) std::isalpha(v[1]))) throw std::domain_error("Invalid argument [" + v + "]");
-
-    opt_name = std::string(v.begin()+1, v.end());
-    return true;
-  }
-
-  bool has_positional_option(const std::string& v, std::string& opt_val) {
-    if (!(v.length())) return false;
-    if (!(v[0] != '-')) throw std::domain_error("The argument [" + v + "] should be a positional value");
-
-    opt_val = v;
-    return true;
-  }
+  bool has_positional_option(const std::string& v, std::string& opt_val);
 
 
   /**
    * parsing ignoring the argv[0] = program_name
    * ex: parse("-a --host=github.com")
+   * Each parse starts from a clean state: the options set by the previous
+   * parse of this map are reset first.
    */
 
-  bool parse(convert c, bool missing_program_name = false, bool ignore_program_name=true) {
-    auto it = c.begin();
-
-    if (!missing_program_name && ignore_program_name)
-      ++it;
-
-      for (; it != c.end(); ++it) {
-        if (has_space(*it))
-          throw std::domain_error("ERROR : found space character in arguments");
-
-        std::cout << "ANA [" << *it << "]" << std::endl;
-          std::string opt_name;
-          std::string opt_val;
-        //CASE '--Option=<str>':
-        {
-          if (has_long_option(*it, opt_name, opt_val)) {
-
-            std::cout << "MATCH " << opt_name << " = " << opt_val << std::endl;
-
-            if (multi_options.find(opt_name) == multi_options.end()) {
-              warnings.push_back("Option [" + *it + "] is ignored");
-              continue;
-            }
-
-            multi_options[opt_name]->value = opt_val;
-//TODO:auto parsing and assign value!!!
-            //multi_options[opt_name]->single_option->se = opt_val;
-            multi_options[opt_name]->enabled = true;
-
-            continue;
-          }
-        }
-
-        //CASE '-s' single short Option :
-        {
-          if (has_single_short_option(*it, opt_name)) {
-
-            std::cout << "MATCH SHORT " << opt_name << " = " << opt_val << std::endl;
-
-            bool matched = false;
-            for (auto& ik : multi_options) {
-              if (ik.second->single_option->get_short_name() == opt_name) {
-                opt_name = ik.second->description;
-                matched = true;
-                std::cout << "short matched ";
-                if (dynamic_cast<FilterAbstract<bool>*>(ik.second->single_option.get())) {
-                  ik.second->enabled = true;
-                  std::cout << " --is bool";
-                } else {
-                  std::cout << " --is value ";
-                  ++it;
-                  if (it == c.end()) throw std::domain_error("The Option [" + *it + "] require a value");
-                  if (!has_positional_option(*it, opt_val)) {
-                    throw std::domain_error("The Option [" + *it + "] require a value");
-                  }
-                  break;
-                }
-              }
-            }
-
-            if (!matched) {
-              warnings.push_back("Option [" + *it + "] is ignored");
-              continue;
-            }
-
-            multi_options[opt_name]->value = opt_val;
-            multi_options[opt_name]->enabled = true;
-            continue;
-          }
-        }
-
-      }
-
-    std::cout << "\nWARNING";
-    for (auto&it : warnings)
-      std::cout << std::endl << it;
-    return true;
-  }
+  bool parse(convert c, bool missing_program_name = false, bool ignore_program_name=true);
 
   bool parse(std::string v, bool missing_program_name = false, bool ignore_program_name=true) {
     return parse(convert(v), missing_program_name, ignore_program_name);
@@ -709,13 +1258,94 @@ class map {
     return parse(convert(argc,argv), missing_program_name, ignore_program_name);
   }
 
+  /**
+   * Same as parse(), but a command line already parsed against this
+   * schema is replayed from the cache: values, converted values,
+   * warnings and reader notifications, without tokenizing or converting
+   * again. Only successful parses are stored.
+   */
+  bool parse(convert c, parse_cache& cache, bool missing_program_name = false, bool ignore_program_name=true);
+
+  bool parse(std::string v, parse_cache& cache, bool missing_program_name = false, bool ignore_program_name=true);
+
+  bool parse(int argc, char **argv, parse_cache& cache, bool missing_program_name = false, bool ignore_program_name=true);
+
+  /**
+   * Parses a new command line, and the environment again, against the
+   * state left by the previous parse: only the options whose raw value
+   * changed are converted again and notified to their readers, the
+   * dropped ones to their removers (see OptionProgrammable). When the new command line is rejected, the
+   * previous state is kept as it was. Without a successful parse of the
+   * same schema version before, every option is checked again.
+   */
+  diff reparse(convert c, bool missing_program_name = false, bool ignore_program_name=true);
+
+  diff reparse(std::string v, bool missing_program_name = false, bool ignore_program_name=true) {
+    return reparse(convert(v), missing_program_name, ignore_program_name);
+  }
+
+  diff reparse(int argc, char **argv, bool missing_program_name = false, bool ignore_program_name=true) {
+    return reparse(convert(argc,argv), missing_program_name, ignore_program_name);
+  }
+
 };
 
-// Utils
+/**
+ * Constraints among options of the same map, checked at the end of parse:
+ *   yacl::exclude(map["x"], map["y"]);        // not both
+ *   yacl::include(map["x"], map["y"]);        // both or none
+ *   yacl::depends(map["x"], map["y"]);        // x needs y
+ *   yacl::at_least_one(map["x"], map["y"]);   // x or y
+ */
+template <typename... Maps>
+void exclude(map& first, map& second, Maps&... others) {
+  schema::add_constraint(schema::EXCLUDE, {&first, &second, &others...});
+}
 
-std::ostream& operator<<(std::ostream&os, map&m) {
-  os << m.to_string();
-  return os;
+template <typename... Maps>
+void include(map& first, map& second, Maps&... others) {
+  schema::add_constraint(schema::INCLUDE, {&first, &second, &others...});
 }
 
+template <typename... Maps>
+void depends(map& option, map& needed, Maps&... others) {
+  schema::add_constraint(schema::DEPENDS, {&option, &needed, &others...});
 }
+
+template <typename... Maps>
+void at_least_one(map& first, map& second, Maps&... others) {
+  schema::add_constraint(schema::AT_LEAST_ONE, {&first, &second, &others...});
+}
+
+// Utils
+
+std::ostream& operator<<(std::ostream&os, map&m);
+
+/**
+ * Templates instantiated once in the compiled library for the common
+ * option types.
+ */
+#define YACL_TEMPLATES(prefix, T) \
+  prefix template class FilterStringStream<T>; \
+  prefix template class Option<T>; \
+  prefix template class filter_oneof<T>; \
+  prefix template void map::req<T>(std::string, std::string); \
+  prefix template void map::opt<T>(std::string, std::string, T); \
+  prefix template T map::as<T>() const;
+
+#ifdef YACL_LIBRARY
+YACL_TEMPLATES(extern, bool)
+YACL_TEMPLATES(extern, int)
+YACL_TEMPLATES(extern, long)
+YACL_TEMPLATES(extern, unsigned int)
+YACL_TEMPLATES(extern, double)
+YACL_TEMPLATES(extern, std::string)
+#endif
+
+}
+
+#ifndef YACL_LIBRARY
+#include "yacl_impl.hpp"
+#endif
+
+#endif
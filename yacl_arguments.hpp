@@ -0,0 +1,205 @@
+#pragma once
+
+/**
+ * Schema-less, allocation-free view of a command line: the arguments are
+ * classified lazily, straight from argv. Shared by yacl::map and by the
+ * embedded configuration (yacl_embedded.hpp), so it uses neither
+ * exceptions nor RTTI.
+ */
+
+#include <cstddef>
+#include <iterator>
+#include <ostream>
+#include <string>
+
+namespace yacl {
+
+/**
+ * Non-owning view on (a part of) an argv string.
+ */
+class arg_view {
+  const char* data_;
+  std::size_t size_;
+
+ public:
+  arg_view() : data_(""), size_(0) {}
+  arg_view(const char* d, std::size_t n) : data_(d), size_(n) {}
+
+  const char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  std::string str() const { return std::string(data_, size_); }
+
+  bool operator==(const arg_view& o) const {
+    return size_ == o.size_ && std::char_traits<char>::compare(data_, o.data_, size_) == 0;
+  }
+  bool operator!=(const arg_view& o) const { return !(*this == o); }
+
+  bool operator==(const char* s) const {
+    return *this == arg_view(s, std::char_traits<char>::length(s));
+  }
+  bool operator!=(const char* s) const { return !(*this == s); }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const arg_view& v) {
+  return os.write(v.data(), v.size());
+}
+
+/**
+ * A single command line argument, classified without any schema:
+ *   --name[=value]  LONG_OPTION
+ *   -abc            SHORT_OPTION (name() = "abc")
+ *   --              SEPARATOR, every following argument is POSITIONAL
+ *   anything else   POSITIONAL (value() = the whole argument)
+ */
+class argument {
+ public:
+  enum kind_type {
+    LONG_OPTION,
+    SHORT_OPTION,
+    POSITIONAL,
+    SEPARATOR
+  };
+
+  argument() : kind_(POSITIONAL), position_(0) {}
+
+  static argument classify(const char* token, std::size_t position, bool after_separator);
+
+  kind_type kind() const { return kind_; }
+  arg_view name() const { return name_; }
+  arg_view value() const { return value_; }
+  arg_view raw() const { return raw_; }
+  std::size_t position() const { return position_; }
+
+  bool is_option() const { return kind_ == LONG_OPTION || kind_ == SHORT_OPTION; }
+  bool has_value() const { return !value_.empty(); }
+
+ private:
+  kind_type kind_;
+  arg_view raw_;
+  arg_view name_;
+  arg_view value_;
+  std::size_t position_;
+};
+
+inline argument argument::classify(const char* token, std::size_t position, bool after_separator) {
+  argument a;
+  std::size_t len = std::char_traits<char>::length(token);
+
+  a.position_ = position;
+  a.raw_ = arg_view(token, len);
+
+  if (after_separator || len < 2 || token[0] != '-') {
+    a.kind_ = POSITIONAL;
+    a.value_ = a.raw_;
+    return a;
+  }
+
+  if (token[1] != '-') {
+    a.kind_ = SHORT_OPTION;
+    a.name_ = arg_view(token + 1, len - 1);
+    return a;
+  }
+
+  if (len == 2) {
+    a.kind_ = SEPARATOR;
+    return a;
+  }
+
+  a.kind_ = LONG_OPTION;
+  const char* eq = static_cast<const char*>(std::char_traits<char>::find(token + 2, len - 2, '='));
+  if (!eq) {
+    a.name_ = arg_view(token + 2, len - 2);
+  } else {
+    a.name_ = arg_view(token + 2, eq - token - 2);
+    a.value_ = arg_view(eq + 1, token + len - eq - 1);
+  }
+  return a;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const argument& a) {
+  return os << a.raw();
+}
+
+/**
+ * Lazy forward range over argv: each argument is classified when the
+ * iterator reaches it, nothing is copied or allocated.
+ *
+ *   for (auto arg : yacl::parse(argc, argv))
+ *     std::cout << arg.name() << " at pos " << arg.position();
+ */
+class arguments {
+ public:
+  class iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef argument value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const argument* pointer;
+    typedef const argument& reference;
+
+    iterator() : argv_(nullptr), pos_(0), argc_(0), after_separator_(false) {}
+
+    iterator(char const* const* argv, int pos, int argc)
+        : argv_(argv), pos_(pos), argc_(argc), after_separator_(false) {
+      load();
+    }
+
+    reference operator*() const { return current_; }
+    pointer operator->() const { return &current_; }
+
+    iterator& operator++() {
+      if (current_.kind() == argument::SEPARATOR)
+        after_separator_ = true;
+      ++pos_;
+      load();
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator tmp(*this);
+      ++*this;
+      return tmp;
+    }
+
+    bool operator==(const iterator& o) const { return pos_ == o.pos_; }
+    bool operator!=(const iterator& o) const { return pos_ != o.pos_; }
+
+   private:
+    void load() {
+      if (pos_ < argc_)
+        current_ = argument::classify(argv_[pos_], pos_, after_separator_);
+    }
+
+    char const* const* argv_;
+    int pos_;
+    int argc_;
+    bool after_separator_;
+    argument current_;
+  };
+
+  arguments(int argc, char const* const* argv, int first)
+      : argc_(argc), argv_(argv), first_(first < argc ? first : argc) {}
+
+  iterator begin() const { return iterator(argv_, first_, argc_); }
+  iterator end() const { return iterator(argv_, argc_, argc_); }
+
+  bool empty() const { return first_ >= argc_; }
+  std::size_t size() const { return argc_ - first_; }
+
+ private:
+  int argc_;
+  char const* const* argv_;
+  int first_;
+};
+
+/**
+ * Schema-less view of the command line, argv[0] is skipped unless
+ * ignore_program_name is false.
+ */
+inline arguments parse(int argc, char const* const* argv, bool ignore_program_name = true) {
+  return arguments(argc < 0 ? 0 : argc, argv, ignore_program_name ? 1 : 0);
+}
+
+}
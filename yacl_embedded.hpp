@@ -0,0 +1,330 @@
+#pragma once
+
+/**
+ * Embedded configuration of yacl, for programs built without exceptions
+ * or RTTI (yacl.hpp switches to it on its own in that case).
+ *
+ * fixed_map<N> holds up to N options bound to variables of the program
+ * and parses argv into them through the lazy yacl::parse() range: the
+ * storage is sized at compile time, parsing does not allocate, and the
+ * errors are reported as parse_status codes.
+ *
+ *   int port = 80;
+ *   bool verbose = false;
+ *
+ *   yacl::fixed_map<8> map;
+ *   map.opt("port", 'p', port, "the remote host port");
+ *   map.opt("verbose", 'v', verbose, "verbose");
+ *
+ *   if (map.parse(argc, argv) != yacl::PARSE_OK)
+ *     std::printf("%s: %.*s\n", yacl::describe(map.status()),
+ *                 (int) map.error().size(), map.error().data());
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <type_traits>
+
+#include "yacl_arguments.hpp"
+
+namespace yacl {
+
+enum parse_status {
+  PARSE_OK = 0,
+  PARSE_MISSING_VALUE,       // an option given without its value
+  PARSE_INVALID_VALUE,       // a value rejected by the type of its variable
+  PARSE_MISSING_REQUIRED,    // a required option not given
+  PARSE_DUPLICATE_OPTION,    // registration: the name or short name is taken
+  PARSE_CAPACITY_EXCEEDED    // registration: more options than the capacity
+};
+
+inline const char* describe(parse_status s) {
+  switch (s) {
+    case PARSE_OK: return "ok";
+    case PARSE_MISSING_VALUE: return "missing value";
+    case PARSE_INVALID_VALUE: return "invalid value";
+    case PARSE_MISSING_REQUIRED: return "required option missing";
+    case PARSE_DUPLICATE_OPTION: return "duplicate option";
+    case PARSE_CAPACITY_EXCEEDED: return "too many options";
+  }
+  return "unknown status";
+}
+
+/**
+ * Value conversions of fixed_map, returning false on invalid values.
+ * Overloads for other types are found by argument dependent lookup.
+ * The values are argv suffixes, so they are NUL terminated.
+ */
+inline bool read_value(arg_view v, arg_view& out) {
+  out = v;
+  return true;
+}
+
+inline bool read_value(arg_view v, const char*& out) {
+  out = v.data();
+  return true;
+}
+
+inline bool read_value(arg_view v, bool& out) {
+  if (v == "1" || v == "true") out = true;
+  else if (v == "0" || v == "false") out = false;
+  else return false;
+  return true;
+}
+
+template <class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, bool>::type
+read_value(arg_view v, T& out) {
+  char* end;
+  errno = 0;
+  long long n = std::strtoll(v.data(), &end, 10);
+  if (v.empty() || errno || end != v.data() + v.size() ||
+      n < std::numeric_limits<T>::min() || n > std::numeric_limits<T>::max())
+    return false;
+
+  out = static_cast<T>(n);
+  return true;
+}
+
+template <class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value &&
+                        !std::is_same<T, bool>::value, bool>::type
+read_value(arg_view v, T& out) {
+  char* end;
+  errno = 0;
+  unsigned long long n = std::strtoull(v.data(), &end, 10);
+  if (v.empty() || v.data()[0] == '-' || errno || end != v.data() + v.size() ||
+      n > std::numeric_limits<T>::max())
+    return false;
+
+  out = static_cast<T>(n);
+  return true;
+}
+
+template <class T>
+typename std::enable_if<std::is_floating_point<T>::value, bool>::type
+read_value(arg_view v, T& out) {
+  char* end;
+  errno = 0;
+  long double n = std::strtold(v.data(), &end);
+  if (v.empty() || errno || end != v.data() + v.size())
+    return false;
+
+  out = static_cast<T>(n);
+  return true;
+}
+
+/**
+ * Fixed capacity option table. Options are given as --name=value,
+ * --name value, -s value, -svalue, and bool flags as --name, -s or
+ * chained (-vq); a flag given without value gets the opposite of the
+ * value its variable had at registration, as map does with opt<bool>.
+ * Unknown options are skipped and counted, '--' ends the options.
+ *
+ * The names and helps are not copied: they must outlive the map, as
+ * must the bound variables.
+ */
+template <std::size_t Capacity>
+class fixed_map {
+  static_assert(Capacity > 0, "a fixed_map needs room for one option at least");
+
+ public:
+  fixed_map() : size_(0), ignored_(0), status_(PARSE_OK) {
+    for (auto& s : shorts_)
+      s = Capacity;
+  }
+
+  template <class T>
+  parse_status opt(const char* name, char short_name, T& target, const char* help) {
+    return add(name, short_name, target, help, false);
+  }
+
+  template <class T>
+  parse_status req(const char* name, char short_name, T& target, const char* help) {
+    return add(name, short_name, target, help, true);
+  }
+
+  /**
+   * Writes the values given in argv into the bound variables, the others
+   * keep theirs. Stops on the first error.
+   */
+  parse_status parse(int argc, char const* const* argv, bool ignore_program_name = true);
+
+  /**
+   * True if the option was given to the last parse.
+   */
+  bool enabled(const char* name) const {
+    std::size_t i = find(view(name));
+    return i != Capacity && options_[i].enabled;
+  }
+
+  const char* help(const char* name) const {
+    std::size_t i = find(view(name));
+    return i != Capacity ? options_[i].help : nullptr;
+  }
+
+  std::size_t size() const { return size_; }
+  static constexpr std::size_t capacity() { return Capacity; }
+
+  /**
+   * Unknown options skipped by the last parse.
+   */
+  std::size_t ignored() const { return ignored_; }
+
+  /**
+   * The last error, and the argument or option name it is about.
+   */
+  parse_status status() const { return status_; }
+  arg_view error() const { return error_; }
+
+ private:
+  struct option {
+    arg_view name;
+    const char* help;
+    bool required;
+    bool flag;
+    bool flag_default;
+    bool enabled;
+    void* target;
+    bool (*read)(arg_view, void*);
+  };
+
+  static arg_view view(const char* s) {
+    return arg_view(s, std::char_traits<char>::length(s));
+  }
+
+  template <class T>
+  static bool read(arg_view v, void* target) {
+    return read_value(v, *static_cast<T*>(target));
+  }
+
+  template <class T>
+  static bool flag_default(const T&) { return false; }
+  static bool flag_default(const bool& v) { return v; }
+
+  template <class T>
+  parse_status add(const char* name, char short_name, T& target, const char* help, bool required) {
+    arg_view n = view(name);
+    if (size_ == Capacity)
+      return fail(PARSE_CAPACITY_EXCEEDED, n);
+    if (find(n) != Capacity || (short_name && shorts_[static_cast<unsigned char>(short_name)] != Capacity))
+      return fail(PARSE_DUPLICATE_OPTION, n);
+
+    option& o = options_[size_];
+    o.name = n;
+    o.help = help;
+    o.required = required;
+    o.flag = std::is_same<T, bool>::value;
+    o.flag_default = flag_default(target);
+    o.enabled = false;
+    o.target = &target;
+    o.read = &fixed_map::read<T>;
+
+    if (short_name)
+      shorts_[static_cast<unsigned char>(short_name)] = size_;
+    ++size_;
+    return PARSE_OK;
+  }
+
+  std::size_t find(arg_view name) const {
+    for (std::size_t i = 0; i < size_; ++i)
+      if (options_[i].name == name)
+        return i;
+    return Capacity;
+  }
+
+  parse_status fail(parse_status s, arg_view where) {
+    status_ = s;
+    error_ = where;
+    return s;
+  }
+
+  parse_status assign(std::size_t i, arg_view v) {
+    options_[i].enabled = true;
+    if (!options_[i].read(v, options_[i].target))
+      return fail(PARSE_INVALID_VALUE, v);
+    return PARSE_OK;
+  }
+
+  void toggle(std::size_t i) {
+    options_[i].enabled = true;
+    *static_cast<bool*>(options_[i].target) = !options_[i].flag_default;
+  }
+
+  /**
+   * Moves it to the value of the option it points to.
+   */
+  parse_status next_value(arguments::iterator& it, const arguments& args, std::size_t i) {
+    arg_view option = it->raw();
+    if (++it == args.end() || it->kind() != argument::POSITIONAL)
+      return fail(PARSE_MISSING_VALUE, option);
+    return assign(i, it->raw());
+  }
+
+  option options_[Capacity];
+  std::size_t shorts_[256];
+  std::size_t size_;
+  std::size_t ignored_;
+  parse_status status_;
+  arg_view error_;
+};
+
+template <std::size_t Capacity>
+parse_status fixed_map<Capacity>::parse(int argc, char const* const* argv, bool ignore_program_name) {
+  status_ = PARSE_OK;
+  error_ = arg_view();
+  ignored_ = 0;
+  for (std::size_t i = 0; i < size_; ++i)
+    options_[i].enabled = false;
+
+  arguments args = yacl::parse(argc, argv, ignore_program_name);
+  for (auto it = args.begin(); status_ == PARSE_OK && it != args.end(); ++it) {
+    if (it->kind() == argument::SEPARATOR)
+      break;
+    if (it->kind() == argument::POSITIONAL)
+      continue;
+
+    arg_view name = it->name();
+
+    if (it->kind() == argument::LONG_OPTION) {
+      std::size_t i = find(name);
+      if (i == Capacity)
+        ++ignored_;
+      else if (it->raw().size() > name.size() + 2)
+        assign(i, it->value());
+      else if (options_[i].flag)
+        toggle(i);
+      else
+        next_value(it, args, i);
+      continue;
+    }
+
+    for (std::size_t k = 0; k < name.size(); ++k) {
+      std::size_t i = shorts_[static_cast<unsigned char>(name.data()[k])];
+      if (i == Capacity) {
+        ++ignored_;
+        break;
+      }
+
+      if (options_[i].flag) {
+        toggle(i);
+        continue;
+      }
+
+      if (k + 1 < name.size())
+        assign(i, arg_view(name.data() + k + 1, name.size() - k - 1));
+      else
+        next_value(it, args, i);
+      break;
+    }
+  }
+
+  for (std::size_t i = 0; i < size_ && status_ == PARSE_OK; ++i)
+    if (options_[i].required && !options_[i].enabled)
+      fail(PARSE_MISSING_REQUIRED, options_[i].name);
+
+  return status_;
+}
+
+}
@@ -0,0 +1,444 @@
+#pragma once
+
+/**
+ * getopt_long compatible front-end for legacy tools.
+ *
+ * The functions keep the exact getopt semantics (optind, optarg, optopt,
+ * opterr, argv permutation, '--', abbreviated long options) but the
+ * 'struct option' table is compiled into a sorted index at the start of
+ * each scan (optind = 0) instead of being scanned linearly for every
+ * argument. The table must not change during a scan.
+ *
+ * Define YACL_GETOPT_IMPLEMENTATION in exactly one C++ translation unit
+ * before including this file to emit the C symbols.
+ */
+
+#include <getopt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int yacl_getopt(int argc, char *const argv[], const char *optstring);
+
+int yacl_getopt_long(int argc, char *const argv[], const char *optstring,
+                     const struct option *longopts, int *longindex);
+
+int yacl_getopt_long_only(int argc, char *const argv[], const char *optstring,
+                          const struct option *longopts, int *longindex);
+
+#ifdef __cplusplus
+}
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace yacl {
+
+/**
+ * A 'struct option' table and its optstring, compiled into a sorted
+ * index of long names and a direct table of short options.
+ */
+class getopt_table {
+ public:
+  enum arg_kind {
+    NONE_ARG = 0,
+    NO_ARG,
+    REQUIRED_ARG,
+    OPTIONAL_ARG
+  };
+
+  getopt_table() : optstring_(nullptr), longopts_(nullptr), w_long_(false) {}
+
+  bool compiled_for(const char *optstring, const struct option *longopts) const {
+    return optstring_ == optstring && longopts_ == longopts;
+  }
+
+  void compile(const char *optstring, const struct option *longopts) {
+    optstring_ = optstring;
+    longopts_ = longopts;
+    std::fill(shorts_, shorts_ + 256, static_cast<unsigned char>(NONE_ARG));
+    std::fill(listed_, listed_ + 256, false);
+    longs_.clear();
+
+    const char *it = optstring;
+    if (*it == '-' || *it == '+') ++it;
+    for (const char *c = it; *c; ++c)
+      listed_[static_cast<unsigned char>(*c)] = true;
+    const char *w = std::strchr(it, 'W');
+    w_long_ = longopts && w && w[1] == ';';
+    if (*it == ':') ++it;
+
+    for (; *it; ++it) {
+      unsigned char c = static_cast<unsigned char>(*it);
+      if (c == ':')
+        continue;
+
+      unsigned char kind = NO_ARG;
+      if (it[1] == ':') {
+        kind = (it[2] == ':') ? OPTIONAL_ARG : REQUIRED_ARG;
+      }
+      shorts_[c] = kind;
+    }
+
+    if (!longopts)
+      return;
+
+    for (int i = 0; longopts[i].name; ++i)
+      longs_.push_back(entry{longopts[i].name, std::strlen(longopts[i].name), i});
+
+    std::sort(longs_.begin(), longs_.end(), [](const entry &a, const entry &b) {
+      return std::strcmp(a.name, b.name) < 0;
+    });
+  }
+
+  arg_kind short_option(char c) const {
+    return static_cast<arg_kind>(shorts_[static_cast<unsigned char>(c)]);
+  }
+
+  /**
+   * True if the character appears anywhere in the optstring, as strchr()
+   * would report it: this is what decides whether getopt_long_only reads
+   * '-x' as a short option.
+   */
+  bool listed(char c) const { return listed_[static_cast<unsigned char>(c)]; }
+
+  /**
+   * True for the GNU extension: "W;" in the optstring and a long option
+   * table make '-W foo' (or '-Wfoo') read as '--foo'.
+   */
+  bool long_after_w() const { return w_long_; }
+
+  /**
+   * Finds the option named by [name, name+len): an exact match wins,
+   * otherwise a unique prefix (or several prefixes describing the same
+   * option, unless long_only) is accepted. Returns -1 when not found, -2
+   * when ambiguous.
+   */
+  int find(const char *name, std::size_t len, bool long_only) const {
+    auto first = std::lower_bound(longs_.begin(), longs_.end(), name,
+                                  [len](const entry &e, const char *n) {
+                                    return std::strncmp(e.name, n, len) < 0;
+                                  });
+
+    int found = -1;
+    for (auto it = first; it != longs_.end() && std::strncmp(it->name, name, len) == 0; ++it) {
+      if (it->len == len)
+        return it->index;
+
+      if (found == -1) {
+        found = it->index;
+      } else if (found >= 0 &&
+                 (long_only || !same_option(longopts_[found], longopts_[it->index]))) {
+        found = -2;
+      }
+    }
+
+    return found;
+  }
+
+  const struct option &long_option(int index) const { return longopts_[index]; }
+
+ private:
+  struct entry {
+    const char *name;
+    std::size_t len;
+    int index;
+  };
+
+  static bool same_option(const struct option &a, const struct option &b) {
+    return a.has_arg == b.has_arg && a.flag == b.flag && a.val == b.val;
+  }
+
+  const char *optstring_;
+  const struct option *longopts_;
+  bool w_long_;
+  unsigned char shorts_[256];
+  bool listed_[256];
+  std::vector<entry> longs_;
+};
+
+/**
+ * The scanning state getopt keeps between calls. optind, optarg, optopt
+ * and opterr are the process-wide variables declared by <getopt.h>, so
+ * legacy code keeps reading them as before.
+ */
+class getopt_parser {
+ public:
+  enum ordering {
+    PERMUTE,
+    REQUIRE_ORDER,
+    RETURN_IN_ORDER
+  };
+
+  getopt_parser()
+      : initialized_(false),
+        nextchar_(nullptr),
+        first_nonopt_(1),
+        last_nonopt_(1),
+        ordering_(PERMUTE) {}
+
+  int next(int argc, char *const argv[], const char *optstring,
+           const struct option *longopts, int *longindex, bool long_only) {
+    if (argc < 1)
+      return -1;
+
+    optarg = nullptr;
+
+    bool restart = optind == 0 || !initialized_;
+    if (restart) {
+      if (optind == 0)
+        optind = 1;
+      first_nonopt_ = last_nonopt_ = optind;
+      nextchar_ = nullptr;
+
+      if (optstring[0] == '-')
+        ordering_ = RETURN_IN_ORDER;
+      else if (optstring[0] == '+' || std::getenv("POSIXLY_CORRECT"))
+        ordering_ = REQUIRE_ORDER;
+      else
+        ordering_ = PERMUTE;
+
+      initialized_ = true;
+    }
+
+    // a table may be refilled in place between scans, so the pointers
+    // alone do not tell whether the index is still valid
+    if (restart || !table_.compiled_for(optstring, longopts))
+      table_.compile(optstring, longopts);
+
+    if (optstring[0] == '-' || optstring[0] == '+')
+      ++optstring;
+    bool silent = optstring[0] == ':';
+    bool print_errors = opterr && !silent;
+
+    if (nextchar_ == nullptr || *nextchar_ == '\0') {
+      if (last_nonopt_ > optind) last_nonopt_ = optind;
+      if (first_nonopt_ > optind) first_nonopt_ = optind;
+
+      if (ordering_ == PERMUTE) {
+        if (first_nonopt_ != last_nonopt_ && last_nonopt_ != optind)
+          exchange(argv);
+        else if (last_nonopt_ != optind)
+          first_nonopt_ = optind;
+
+        while (optind < argc && is_nonoption(argv[optind]))
+          ++optind;
+        last_nonopt_ = optind;
+      }
+
+      if (optind != argc && std::strcmp(argv[optind], "--") == 0) {
+        ++optind;
+
+        if (first_nonopt_ != last_nonopt_ && last_nonopt_ != optind)
+          exchange(argv);
+        else if (first_nonopt_ == last_nonopt_)
+          first_nonopt_ = optind;
+
+        last_nonopt_ = argc;
+        optind = argc;
+      }
+
+      if (optind == argc) {
+        if (first_nonopt_ != last_nonopt_)
+          optind = first_nonopt_;
+        return -1;
+      }
+
+      if (is_nonoption(argv[optind])) {
+        if (ordering_ == REQUIRE_ORDER)
+          return -1;
+
+        optarg = argv[optind++];
+        return 1;
+      }
+
+      if (longopts) {
+        if (argv[optind][1] == '-') {
+          nextchar_ = argv[optind] + 2;
+          return next_long(argc, argv, longindex, "--", silent, print_errors, long_only, true);
+        }
+
+        if (long_only && (argv[optind][2] || !table_.listed(argv[optind][1]))) {
+          nextchar_ = argv[optind] + 1;
+          int c = next_long(argc, argv, longindex, "-", silent, print_errors, long_only, false);
+          if (c != -1)
+            return c;
+        }
+      }
+
+      nextchar_ = argv[optind] + 1;
+    }
+
+    return next_short(argc, argv, longindex, silent, print_errors);
+  }
+
+ private:
+  static bool is_nonoption(const char *arg) {
+    return arg[0] != '-' || arg[1] == '\0';
+  }
+
+  /**
+   * Moves the non-options found in [first_nonopt_, last_nonopt_) after
+   * the options in [last_nonopt_, optind).
+   */
+  void exchange(char *const argv[]) {
+    char **args = const_cast<char **>(argv);
+    std::rotate(args + first_nonopt_, args + last_nonopt_, args + optind);
+    first_nonopt_ += optind - last_nonopt_;
+    last_nonopt_ = optind;
+  }
+
+  int next_long(int argc, char *const argv[], int *longindex, const char *prefix,
+                bool silent, bool print_errors, bool long_only, bool must_match) {
+    const char *name = nextchar_;
+    std::size_t len = std::strcspn(name, "=");
+    int index = table_.find(name, len, long_only);
+
+    if (index == -2) {
+      if (print_errors)
+        std::fprintf(stderr, "%s: option '%s%.*s' is ambiguous\n",
+                     argv[0], prefix, static_cast<int>(len), name);
+      nextchar_ = nullptr;
+      ++optind;
+      optopt = 0;
+      return '?';
+    }
+
+    if (index == -1) {
+      if (!must_match && table_.listed(*name))
+        return -1;
+
+      if (print_errors)
+        std::fprintf(stderr, "%s: unrecognized option '%s%s'\n", argv[0], prefix, name);
+      nextchar_ = nullptr;
+      ++optind;
+      optopt = 0;
+      return '?';
+    }
+
+    const struct option &opt = table_.long_option(index);
+    nextchar_ = nullptr;
+    ++optind;
+
+    if (name[len] == '=') {
+      if (opt.has_arg == no_argument) {
+        if (print_errors)
+          std::fprintf(stderr, "%s: option '%s%s' doesn't allow an argument\n",
+                       argv[0], prefix, opt.name);
+        optopt = opt.val;
+        return '?';
+      }
+      optarg = const_cast<char *>(name + len + 1);
+    } else if (opt.has_arg == required_argument) {
+      if (optind >= argc) {
+        if (print_errors)
+          std::fprintf(stderr, "%s: option '%s%s' requires an argument\n",
+                       argv[0], prefix, opt.name);
+        optopt = opt.val;
+        return silent ? ':' : '?';
+      }
+      optarg = argv[optind++];
+    }
+
+    if (longindex)
+      *longindex = index;
+
+    if (opt.flag) {
+      *opt.flag = opt.val;
+      return 0;
+    }
+
+    return opt.val;
+  }
+
+  int next_short(int argc, char *const argv[], int *longindex, bool silent, bool print_errors) {
+    char c = *nextchar_++;
+    getopt_table::arg_kind kind = table_.short_option(c);
+
+    if (*nextchar_ == '\0')
+      ++optind;
+
+    if (kind == getopt_table::NONE_ARG || c == ':' || c == ';') {
+      if (print_errors)
+        std::fprintf(stderr, "%s: invalid option -- '%c'\n", argv[0], c);
+      optopt = c;
+      return '?';
+    }
+
+    if (c == 'W' && table_.long_after_w()) {
+      if (*nextchar_ == '\0') {
+        if (optind == argc) {
+          if (print_errors)
+            std::fprintf(stderr, "%s: option requires an argument -- '%c'\n", argv[0], c);
+          optopt = c;
+          return silent ? ':' : '?';
+        }
+        nextchar_ = argv[optind];
+      }
+      return next_long(argc, argv, longindex, "-W ", silent, print_errors, false, true);
+    }
+
+    if (kind == getopt_table::OPTIONAL_ARG) {
+      if (*nextchar_ != '\0') {
+        optarg = nextchar_;
+        ++optind;
+      }
+      nextchar_ = nullptr;
+    } else if (kind == getopt_table::REQUIRED_ARG) {
+      if (*nextchar_ != '\0') {
+        optarg = nextchar_;
+        ++optind;
+      } else if (optind == argc) {
+        if (print_errors)
+          std::fprintf(stderr, "%s: option requires an argument -- '%c'\n", argv[0], c);
+        optopt = c;
+        c = silent ? ':' : '?';
+      } else {
+        optarg = argv[optind++];
+      }
+      nextchar_ = nullptr;
+    }
+
+    return c;
+  }
+
+  bool initialized_;
+  char *nextchar_;
+  int first_nonopt_;
+  int last_nonopt_;
+  ordering ordering_;
+  getopt_table table_;
+};
+
+}
+
+#ifdef YACL_GETOPT_IMPLEMENTATION
+
+namespace yacl {
+inline getopt_parser &getopt_state() {
+  static getopt_parser parser;
+  return parser;
+}
+}
+
+extern "C" int yacl_getopt(int argc, char *const argv[], const char *optstring) {
+  return yacl::getopt_state().next(argc, argv, optstring, nullptr, nullptr, false);
+}
+
+extern "C" int yacl_getopt_long(int argc, char *const argv[], const char *optstring,
+                                const struct option *longopts, int *longindex) {
+  return yacl::getopt_state().next(argc, argv, optstring, longopts, longindex, false);
+}
+
+extern "C" int yacl_getopt_long_only(int argc, char *const argv[], const char *optstring,
+                                     const struct option *longopts, int *longindex) {
+  return yacl::getopt_state().next(argc, argv, optstring, longopts, longindex, true);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,1436 @@
+#pragma once
+
+/**
+ * Out-of-line definitions of the non-template parts of yacl.
+ *
+ * Header-only builds get them through yacl.hpp, the compiled library
+ * (YACL_LIBRARY) builds them once in yacl.cpp.
+ */
+
+#include "yacl.hpp"
+
+#include <atomic>
+#include <cctype>
+#include <clocale>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+extern char **environ;
+
+namespace yacl {
+
+YACL_INLINE convert::convert(int argc, type_argv argv)
+    : argc_(argc)
+    , argv_(argv)
+{
+}
+
+YACL_INLINE convert::convert(std::string s_argv)
+    : s_argv_(s_argv)
+{
+  tokenize(s_argv_, buffer_, offsets_);
+  argc_ = offsets_.size();
+}
+
+YACL_INLINE std::string convert::words(std::size_t first) const {
+  if (first >= size())
+    return std::string();
+
+  if (!offsets_.empty())
+    return buffer_.substr(offsets_[first]);
+
+  std::size_t bytes = 0;
+  for (std::size_t i = first; i < size(); ++i)
+    bytes += std::strlen(argv_[i]) + 1;
+
+  std::string s;
+  s.reserve(bytes);
+  for (std::size_t i = first; i < size(); ++i)
+    s.append(argv_[i], std::strlen(argv_[i]) + 1);
+  return s;
+}
+
+YACL_INLINE const std::vector<std::string>& convert::strings() {
+  if (v_argv_.size() != size()) {
+    v_argv_.clear();
+    v_argv_.reserve(size());
+    for (std::size_t i = 0; i < size(); ++i)
+      v_argv_.emplace_back(token(i));
+  }
+  return v_argv_;
+}
+
+YACL_INLINE const std::string& convert::line() {
+  if (offsets_.empty() && s_argv_.empty())
+    for (std::size_t i = 0; i < size(); ++i)
+      s_argv_.append(i ? " " : "").append(argv_[i]);
+  return s_argv_;
+}
+
+YACL_INLINE std::size_t convert::plain(const char* first, const char* last, const char* specials, std::size_t n) {
+  const char* it = first;
+
+#if defined(__SSE2__)
+  for (; last - it >= 16; it += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+    __m128i hit = _mm_setzero_si128();
+    for (std::size_t i = 0; i < n; ++i)
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(specials[i])));
+    if (_mm_movemask_epi8(hit))
+      break;
+  }
+#endif
+
+  for (; it != last; ++it)
+    if (std::memchr(specials, *it, n))
+      break;
+
+  return it - first;
+}
+
+YACL_INLINE void convert::tokenize(const std::string& s, std::string& buffer, std::vector<std::size_t>& offsets) {
+  enum { BLANK, WORD, SINGLE_QUOTED, DOUBLE_QUOTED } state = BLANK;
+  const char* it = s.data();
+  const char* end = it + s.size();
+
+  buffer.reserve(s.size() + 1);
+
+  while (it != end) {
+    switch (state) {
+      case BLANK:
+        if (*it == ' ' || *it == '\t' || *it == '\n') {
+          ++it;
+        } else if (*it == '\\' && end - it > 1 && it[1] == '\n') {
+          it += 2;
+        } else {
+          offsets.push_back(buffer.size());
+          state = WORD;
+        }
+        break;
+
+      case WORD: {
+        std::size_t n = plain(it, end, " \t\n'\"\\", 6);
+        buffer.append(it, n);
+        it += n;
+        if (it == end)
+          break;
+
+        char c = *it++;
+        if (c == '\'') {
+          state = SINGLE_QUOTED;
+        } else if (c == '"') {
+          state = DOUBLE_QUOTED;
+        } else if (c == '\\') {
+          if (it == end)
+            throw std::domain_error("Incomplete escape in [" + s + "]");
+          if (*it != '\n')
+            buffer += *it;
+          ++it;
+        } else {
+          buffer += '\0';
+          state = BLANK;
+        }
+        break;
+      }
+
+      case SINGLE_QUOTED: {
+        std::size_t n = plain(it, end, "'", 1);
+        buffer.append(it, n);
+        it += n;
+        if (it != end) {
+          ++it;
+          state = WORD;
+        }
+        break;
+      }
+
+      case DOUBLE_QUOTED: {
+        std::size_t n = plain(it, end, "\"\\", 2);
+        buffer.append(it, n);
+        it += n;
+        if (it == end)
+          break;
+
+        if (*it++ == '"') {
+          state = WORD;
+        } else if (it != end) {
+          if (*it != '$' && *it != '`' && *it != '"' && *it != '\\' && *it != '\n')
+            buffer += '\\';
+          if (*it != '\n')
+            buffer += *it;
+          ++it;
+        }
+        break;
+      }
+    }
+  }
+
+  if (state == SINGLE_QUOTED || state == DOUBLE_QUOTED)
+    throw std::domain_error("Unterminated quote in [" + s + "]");
+  if (state == WORD)
+    buffer += '\0';
+}
+
+YACL_INLINE convert::type_argv convert::materialize() const {
+  char* block = new char[argc_ * sizeof(char*) + buffer_.size()];
+  type_argv argv = reinterpret_cast<type_argv>(block);
+  char* text = block + argc_ * sizeof(char*);
+
+  std::memcpy(text, buffer_.data(), buffer_.size());
+  for (int i = 0; i < argc_; ++i)
+    argv[i] = text + offsets_[i];
+  return argv;
+}
+
+namespace filters {
+
+YACL_INLINE void lower_case::fold(std::string &s) {
+  char *it = &s[0];
+  char *end = it + s.length();
+
+#if defined(__SSE2__)
+  const __m128i before_a = _mm_set1_epi8('A' - 1);
+  const __m128i after_z = _mm_set1_epi8('Z' + 1);
+  const __m128i delta = _mm_set1_epi8('a' - 'A');
+
+  for (; end - it >= 16; it += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(it));
+    if (_mm_movemask_epi8(chunk))
+      break;
+
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, before_a),
+                                  _mm_cmplt_epi8(chunk, after_z));
+    chunk = _mm_add_epi8(chunk, _mm_and_si128(upper, delta));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(it), chunk);
+  }
+#endif
+
+  for (; it != end; ++it) {
+    unsigned char c = static_cast<unsigned char>(*it);
+    if (c & 0x80)
+      break;
+    if (c >= 'A' && c <= 'Z')
+      *it = static_cast<char>(c + ('a' - 'A'));
+  }
+
+  for (; it != end; ++it)
+    *it = static_cast<char>(std::tolower(static_cast<unsigned char>(*it)));
+}
+
+}
+
+YACL_INLINE std::string map::key(const std::string& s) const {
+  if (!case_insensitive)
+    return s;
+
+  std::string k(s);
+  filters::lower_case::fold(k);
+  return k;
+}
+
+YACL_INLINE void map::set_case_insensitive(bool v) {
+  if (case_insensitive == v)
+    return;
+
+  check_fold(v);
+
+  case_insensitive = v;
+  if (table)
+    ++table->version_;
+
+  std::unordered_map<std::string, std::size_t> rekeyed;
+  for (auto& it : children) {
+    std::string k = key(table->spellings[it.second]);
+    table->names[it.second] = k;
+    table->node(it.second).set_case_insensitive(v);
+    rekeyed.emplace(k, it.second);
+  }
+  children.swap(rekeyed);
+}
+
+YACL_INLINE void map::check_fold(bool v) const {
+  if (!v || case_insensitive)
+    return;
+
+  std::unordered_map<std::string, std::size_t> folded;
+  for (auto& it : children) {
+    std::string k = table->spellings[it.second];
+    filters::lower_case::fold(k);
+
+    auto f = folded.emplace(k, it.second);
+    if (!f.second)
+      throw std::domain_error("The options [" + table->spellings[f.first->second] + "] and [" +
+                              table->spellings[it.second] + "] only differ by their case");
+
+    table->nodes[it.second]->check_fold(v);
+  }
+}
+
+YACL_INLINE map::map(const std::string& s) {
+  state().owner = std::make_shared<schema>();
+  table = state().owner.get();
+  id = table->add(s);
+}
+
+YACL_INLINE map::map(const map& m)
+    : OptionProgrammable(m)
+    , table(m.table)
+    , id(m.id)
+    , children(m.children)
+    , case_insensitive(m.case_insensitive)
+    , ctx(m.ctx ? new context(*m.ctx) : nullptr)
+{
+}
+
+YACL_INLINE map& map::operator=(const map& m) {
+  if (this == &m)
+    return *this;
+
+  OptionProgrammable::operator=(m);
+  table = m.table;
+  id = m.id;
+  children = m.children;
+  case_insensitive = m.case_insensitive;
+  ctx.reset(m.ctx ? new context(*m.ctx) : nullptr);
+  return *this;
+}
+
+YACL_INLINE map::context& map::state() {
+  if (!ctx)
+    ctx.reset(new context());
+  return *ctx;
+}
+
+YACL_INLINE const std::vector<std::string>& map::get_warnings() const {
+  static const std::vector<std::string> none;
+  return ctx ? ctx->warnings : none;
+}
+
+YACL_INLINE map& map::operator[](const std::string& s) {
+  std::string k = key(s);
+  auto it = children.find(k);
+  if (it != children.end()) {
+    return table->node(it->second);
+  }
+
+  if (!table) {
+    state().owner = std::make_shared<schema>();
+    table = state().owner.get();
+  }
+
+  std::size_t child = table->add(k);
+  table->spellings[child] = s;
+  table->node(child).case_insensitive = case_insensitive;
+  children.emplace(k, child);
+  return table->node(child);
+}
+
+YACL_INLINE void map::enable(std::size_t option, const std::string& v) {
+  table->values[option] = v;
+  table->enabled.set(option);
+}
+
+YACL_INLINE void map::validate(const matches& found, snapshot* saved) {
+  // every occurrence of an option is converted, in order, by the same task
+  std::vector<std::vector<std::size_t>> tasks;
+  std::unordered_map<std::size_t, std::size_t> task_of;
+  for (std::size_t i = 0; i < found.size(); ++i) {
+    if (!table->options[found[i].first])
+      continue;
+
+    auto t = task_of.emplace(found[i].first, tasks.size());
+    if (t.second)
+      tasks.emplace_back();
+    tasks[t.first->second].push_back(i);
+  }
+
+  if (saved) {
+    for (auto& t : tasks) {
+      std::size_t o = found[t.front()].first;
+      saved->emplace_back(o, tdata::BData());
+      table->options[o]->save_value(saved->back().second);
+    }
+  }
+
+  // what is not a std::exception is not a rejection: it is rethrown as
+  // is, on the calling thread
+  std::vector<std::string> errors(found.size());
+  std::vector<std::exception_ptr> failures(found.size());
+  auto reject = [&](std::size_t i, const std::exception& e) {
+    errors[i] = "Option [" + table->names[found[i].first] + "] rejects [" +
+        found[i].second + "]: " + e.what();
+  };
+
+  auto run = [&](std::size_t task) {
+    std::size_t option = found[tasks[task].front()].first;
+    if (table->dictionaries.test(option)) {
+      // all the definitions make a single value
+      dictionary d;
+      d.reserve(tasks[task].size());
+      for (auto i : tasks[task]) {
+        try {
+          d.define(found[i].second);
+        } catch (const std::exception& e) {
+          reject(i, e);
+        } catch (...) {
+          failures[i] = std::current_exception();
+        }
+      }
+      static_cast<Option<dictionary>*>(table->options[option].get())->get_cmdline_value() = std::move(d);
+      return;
+    }
+
+    for (auto i : tasks[task]) {
+      try {
+        table->options[option]->set_value(found[i].second);
+      } catch (const std::exception& e) {
+        reject(i, e);
+      } catch (...) {
+        failures[i] = std::current_exception();
+      }
+    }
+  };
+
+  // the files named by file_exist values are stat'ed in one batch first,
+  // then their filters read it
+  file_batch files;
+  for (auto& t : tasks)
+    if (table->options[found[t.front()].first]->checks_files())
+      for (auto i : t)
+        files.add(found[i].second);
+
+  unsigned threads = state().validation_threads;
+  std::size_t workers = threads ? threads : std::thread::hardware_concurrency();
+  workers = std::max<std::size_t>(workers, 1);
+
+  thread_pool* pool = nullptr;
+  if (workers > 1 && std::max(tasks.size(), files.size()) > 1) {
+    std::shared_ptr<thread_pool>& p = state().pool;
+    if (!p || p->size() != workers)
+      p = std::make_shared<thread_pool>(workers);
+    pool = p.get();
+  }
+  auto each = [pool](std::size_t n, const std::function<void(std::size_t)>& task) {
+    if (pool) {
+      pool->run(n, task);
+    } else {
+      for (std::size_t i = 0; i < n; ++i)
+        task(i);
+    }
+  };
+
+  each(files.size(), [&files](std::size_t i) { files.load(i); });
+  each(tasks.size(), [&](std::size_t t) {
+    file_batch::current() = &files;
+    run(t);
+    file_batch::current() = nullptr;
+  });
+
+  std::vector<std::string> rejected;
+  for (auto& e : errors)
+    if (!e.empty())
+      rejected.push_back(e);
+
+  auto failure = std::find_if(failures.begin(), failures.end(),
+                              [](const std::exception_ptr& f) { return f != nullptr; });
+  if (failure != failures.end() || !rejected.empty()) {
+    if (saved)
+      for (auto& v : *saved)
+        table->options[v.first]->load_value(v.second);
+    if (failure != failures.end())
+      std::rethrow_exception(*failure);
+    throw validation_error(rejected);
+  }
+}
+
+YACL_INLINE void map::announce(const matches& found) {
+  for (auto& m : found)
+    table->node(m.first).notify(m.second, false);
+}
+
+YACL_INLINE const std::vector<std::size_t>& map::shorts() {
+  context& st = state();
+  if (st.short_version == table->version())
+    return st.short_index;
+
+  st.short_index.assign(256, schema::npos);
+  for (auto& it : children) {
+    const std::string& s = table->short_names[it.second];
+    if (s.length() == 1 && st.short_index[static_cast<unsigned char>(s[0])] == schema::npos)
+      st.short_index[static_cast<unsigned char>(s[0])] = it.second;
+  }
+
+  st.short_version = table->version();
+  return st.short_index;
+}
+
+YACL_INLINE const bitset& map::scope() {
+  context& st = state();
+  if (st.scope_version == table->version())
+    return st.scope_mask;
+
+  st.scope_mask.words.assign(table->size() / bitset::word_bits + 1, 0);
+  for (auto& it : children)
+    st.scope_mask.set(it.second);
+
+  st.scope_version = table->version();
+  return st.scope_mask;
+}
+
+YACL_INLINE bool map::has_long_option(const std::string& v, std::string& opt_name, std::string& opt_val) {
+  if (!(v.length() > 1)) return false;
+  if (!(v[0] == '-' && v[1] == '-')) return false;
+  if (!(v.length() >= 5)) throw std::domain_error("Invalid argument [" + v + "]");
+  if (!((bool) std::isalpha(v[2]))) throw std::domain_error("Invalid argument [" + v + "]");
+  if (!split_assignment(v.begin()+2, v.end(), opt_name, opt_val)) return false;
+  if (opt_val.empty()) throw std::domain_error("Incomplete argument [" +  v + "]");
+
+  return true;
+}
+
+YACL_INLINE bool map::has_single_short_option(const std::string& v, std::string& opt_name) {
+  if (!(v.length() == 2)) return false;
+  if (!(v[0] == '-')) return false;
+  if (!((bool) std::isalpha(v[1]))) throw std::domain_error("Invalid argument [" + v + "]");
+
+  opt_name = std::string(v.begin()+1, v.end());
+  return true;
+}
+
+YACL_INLINE bool map::has_positional_option(const std::string& v, std::string& opt_val) {
+  if (!(v.length())) return false;
+  if (!(v[0] != '-')) throw std::domain_error("The argument [" + v + "] should be a positional value");
+
+  opt_val = v;
+  return true;
+}
+
+YACL_INLINE std::string map::arguments(convert& c, bool missing_program_name, bool ignore_program_name) {
+  return c.words(!missing_program_name && ignore_program_name ? 1 : 0);
+}
+
+YACL_INLINE map& map::env(const std::string& variable) {
+  check_condition();
+  table->variables[id] = variable;
+  ++table->version_;
+  return *this;
+}
+
+YACL_INLINE map& map::env_prefix(const std::string& prefix) {
+  context& st = state();
+  st.environment_prefix = prefix;
+  st.env_version = schema::npos;
+  return *this;
+}
+
+YACL_INLINE const std::vector<std::pair<std::string, std::size_t>>& map::env_names() {
+  context& st = state();
+  if (st.env_version == table->version())
+    return st.env_index;
+
+  // one variable per option, the one given with env() first
+  std::unordered_map<std::string, std::size_t> names;
+  for (auto& it : children) {
+    if (!table->variables[it.second].empty()) {
+      names.emplace(table->variables[it.second], it.second);
+    } else if (!st.environment_prefix.empty()) {
+      std::string v = st.environment_prefix;
+      for (char c : table->names[it.second])
+        v += (c == '-' || c == '.') ? '_' : static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+      names.emplace(v, it.second);
+    }
+  }
+
+  st.env_index.assign(names.begin(), names.end());
+  std::sort(st.env_index.begin(), st.env_index.end());
+  st.env_version = table->version();
+  return st.env_index;
+}
+
+YACL_INLINE map::matches map::environment() {
+  matches env;
+  if (!table)
+    return env;
+
+  const auto& index = env_names();
+  if (index.empty())
+    return env;
+
+  for (char** e = environ; e && *e; ++e) {
+    const char* eq = std::strchr(*e, '=');
+    if (!eq)
+      continue;
+
+    const char* name = *e;
+    std::size_t len = eq - name;
+    auto it = std::lower_bound(index.begin(), index.end(), name,
+                               [len](const std::pair<std::string, std::size_t>& v, const char* n) {
+                                 return v.first.compare(0, v.first.size(), n, len) < 0;
+                               });
+    if (it != index.end() && it->first.compare(0, it->first.size(), name, len) == 0)
+      env.emplace_back(it->second, std::string(eq + 1));
+  }
+
+  // one match per option: a variable defined twice in environ is read
+  // as getenv() does
+  typedef std::pair<std::size_t, std::string> match;
+  std::stable_sort(env.begin(), env.end(),
+                   [](const match& a, const match& b) { return a.first < b.first; });
+  env.erase(std::unique(env.begin(), env.end(),
+                        [](const match& a, const match& b) { return a.first == b.first; }),
+            env.end());
+  return env;
+}
+
+YACL_INLINE void map::fallback(matches& found, const matches& env) {
+  if (env.empty())
+    return;
+
+  bitset given;
+  for (auto& m : found)
+    given.set(m.first);
+
+  for (auto& m : env)
+    if (!given.test(m.first))
+      found.push_back(m);
+}
+
+YACL_INLINE void map::scan(const std::string& args, matches& found) {
+  std::vector<std::string>& warnings = state().warnings;
+  // one argument at a time, reusing the same strings
+  std::string arg, opt_name, opt_val;
+  const char* current = nullptr;
+  std::size_t pos = 0;
+  auto next = [&]() {
+    if (pos >= args.size())
+      return false;
+
+    current = args.data() + pos;
+    std::size_t end = args.find('\0', pos);
+    arg.assign(args, pos, end - pos);
+    pos = end + 1;
+    return true;
+  };
+
+  while (next()) {
+    // '--' ends the options, what follows is positional
+    if (arg == "--")
+      break;
+
+    //CASE '--Option=<str>':
+    if (has_long_option(arg, opt_name, opt_val)) {
+      // opt_name is scratch: folded in place rather than through key()
+      if (case_insensitive)
+        filters::lower_case::fold(opt_name);
+      auto ik = children.find(opt_name);
+      if (ik == children.end()) {
+        warnings.push_back("Option [" + arg + "] is ignored");
+        continue;
+      }
+
+      found.emplace_back(ik->second, opt_val);
+      continue;
+    }
+
+    //CASE '--dictionary name=value' and '-Dname=value':
+    if (table && arg.length() > 2 && arg[0] == '-') {
+      std::size_t matched = schema::npos;
+      if (arg[1] == '-') {
+        opt_name.assign(arg, 2, std::string::npos);
+        if (case_insensitive)
+          filters::lower_case::fold(opt_name);
+        auto ik = children.find(opt_name);
+        if (ik != children.end())
+          matched = ik->second;
+      } else {
+        matched = shorts()[static_cast<unsigned char>(arg[1])];
+        if (matched != schema::npos && table->dictionaries.test(matched)) {
+          found.emplace_back(matched, arg.substr(2));
+          continue;
+        }
+      }
+
+      if (matched != schema::npos && table->dictionaries.test(matched)) {
+        const char* option = current;
+        if (!next() || !has_positional_option(arg, opt_val))
+          throw std::domain_error("The Option [" + std::string(option) + "] require a value");
+
+        found.emplace_back(matched, opt_val);
+        continue;
+      }
+    }
+
+    //CASE '-s' single short Option :
+    if (has_single_short_option(arg, opt_name)) {
+      std::size_t matched = table ? shorts()[static_cast<unsigned char>(opt_name[0])] : schema::npos;
+
+      if (matched == schema::npos) {
+        warnings.push_back("Option [" + arg + "] is ignored");
+        continue;
+      }
+
+      if (table->flags.test(matched)) {
+        opt_val.clear();
+      } else if (!next() || !has_positional_option(arg, opt_val)) {
+        throw std::domain_error("The Option [-" + opt_name + "] require a value");
+      }
+
+      found.emplace_back(matched, opt_val);
+      continue;
+    }
+  }
+}
+
+YACL_INLINE bool map::parse(convert c, bool missing_program_name, bool ignore_program_name) {
+  context& st = state();
+  reset();
+  std::string args = arguments(c, missing_program_name, ignore_program_name);
+  matches env = environment();
+
+  matches found;
+  scan(args, found);
+  fallback(found, env);
+  apply(found);
+
+  st.tokens.swap(args);
+  st.env_values.swap(env);
+  st.parsed_version = table ? table->version() : schema::npos;
+  return true;
+}
+
+YACL_INLINE void map::apply(const matches& found) {
+  context& st = state();
+  validate(found);
+
+  for (auto& m : found) {
+    if (!table->enabled.test(m.first))
+      st.active.push_back(m.first);
+
+    enable(m.first, m.second);
+    if (table->dictionaries.test(m.first))
+      st.definitions[m.first].push_back(m.second);
+  }
+
+  try {
+    if (table)
+      table->check(scope());
+  } catch (...) {
+    for (auto o : st.active) {
+      table->values[o].clear();
+      table->enabled.set(o, false);
+    }
+    st.active.clear();
+    st.definitions.clear();
+    throw;
+  }
+
+  announce(found);
+}
+
+YACL_INLINE void map::reset() {
+  context& st = state();
+  for (auto o : st.active) {
+    table->values[o].clear();
+    table->enabled.set(o, false);
+  }
+
+  st.active.clear();
+  st.definitions.clear();
+  st.tokens.clear();
+  st.env_values.clear();
+  st.parsed_version = schema::npos;
+  st.warnings.clear();
+}
+
+struct thread_pool::shared {
+  std::mutex batch;  // held by run() for a whole batch
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::vector<std::thread> workers;
+
+  const std::function<void(std::size_t)>* task = nullptr;
+  std::size_t tasks = 0;
+  std::atomic<std::size_t> next{0};
+  std::size_t pending = 0;     // workers not done with the batch yet
+  std::size_t generation = 0;  // batches started so far
+  bool stop = false;
+  std::exception_ptr error;
+
+  void work() {
+    for (std::size_t i; (i = next++) < tasks;) {
+      try {
+        (*task)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  }
+
+  void serve() {
+    for (std::size_t seen = 0;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]() { return stop || generation != seen; });
+        if (stop)
+          return;
+        seen = generation;
+      }
+      work();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pending == 0)
+        done.notify_one();
+    }
+  }
+};
+
+YACL_INLINE thread_pool::thread_pool(std::size_t threads)
+    : size_(std::max<std::size_t>(threads, 1)),
+      shared_(new shared())
+{
+  shared* s = shared_.get();
+  for (std::size_t w = 1; w < size_; ++w)
+    s->workers.emplace_back([s]() { s->serve(); });
+}
+
+YACL_INLINE thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> lock(shared_->mutex);
+    shared_->stop = true;
+  }
+  shared_->wake.notify_all();
+  for (auto& w : shared_->workers)
+    w.join();
+}
+
+YACL_INLINE void thread_pool::run(std::size_t n, const std::function<void(std::size_t)>& task) {
+  shared& s = *shared_;
+  std::lock_guard<std::mutex> batch(s.batch);
+
+  if (n < 2 || s.workers.empty()) {
+    for (std::size_t i = 0; i < n; ++i)
+      task(i);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.task = &task;
+    s.tasks = n;
+    s.next = 0;
+    s.pending = s.workers.size();
+    s.error = nullptr;
+    ++s.generation;
+  }
+  s.wake.notify_all();
+  s.work();
+
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(s.mutex);
+    s.done.wait(lock, [&]() { return s.pending == 0; });
+    s.task = nullptr;
+    std::swap(error, s.error);
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+struct parse_cache::result {
+  std::vector<std::pair<std::size_t, std::string>> found;
+  std::vector<std::pair<std::size_t, tdata::BData>> values;
+  std::string tokens;
+  std::vector<std::string> warnings;
+};
+
+struct parse_cache::store {
+  typedef std::pair<std::string, std::shared_ptr<const result>> entry;
+
+  // FNV-1a over 8 byte words, then a final avalanche
+  static std::uint64_t hash(const std::string& key) {
+    std::uint64_t h = 14695981039346656037ull;
+    const char* p = key.data();
+    std::size_t n = key.size();
+
+    for (; n >= 8; p += 8, n -= 8) {
+      std::uint64_t w;
+      std::memcpy(&w, p, 8);
+      h = (h ^ w) * 1099511628211ull;
+    }
+    for (; n; ++p, --n)
+      h = (h ^ static_cast<unsigned char>(*p)) * 1099511628211ull;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+  }
+
+  std::mutex mutex;
+  std::list<entry> lru;  // most recently used first
+  std::unordered_map<std::uint64_t, std::list<entry>::iterator> index;
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+};
+
+YACL_INLINE parse_cache::parse_cache(std::size_t capacity)
+    : capacity_(std::max<std::size_t>(capacity, 1)),
+      store_(std::make_shared<store>())
+{}
+
+YACL_INLINE std::size_t parse_cache::size() const {
+  std::lock_guard<std::mutex> lock(store_->mutex);
+  return store_->lru.size();
+}
+
+YACL_INLINE std::size_t parse_cache::hits() const {
+  std::lock_guard<std::mutex> lock(store_->mutex);
+  return store_->hits;
+}
+
+YACL_INLINE std::size_t parse_cache::misses() const {
+  std::lock_guard<std::mutex> lock(store_->mutex);
+  return store_->misses;
+}
+
+YACL_INLINE void parse_cache::clear() {
+  std::lock_guard<std::mutex> lock(store_->mutex);
+  store_->lru.clear();
+  store_->index.clear();
+}
+
+YACL_INLINE std::shared_ptr<const parse_cache::result> parse_cache::find(const std::string& key) {
+  std::uint64_t h = store::hash(key);
+
+  std::lock_guard<std::mutex> lock(store_->mutex);
+  auto it = store_->index.find(h);
+  if (it == store_->index.end() || it->second->first != key) {
+    ++store_->misses;
+    return nullptr;
+  }
+
+  ++store_->hits;
+  store_->lru.splice(store_->lru.begin(), store_->lru, it->second);
+  return it->second->second;
+}
+
+YACL_INLINE void parse_cache::insert(const std::string& key, std::shared_ptr<const result> r) {
+  std::uint64_t h = store::hash(key);
+
+  std::lock_guard<std::mutex> lock(store_->mutex);
+  auto it = store_->index.find(h);
+  if (it != store_->index.end())
+    store_->lru.erase(it->second);
+
+  store_->lru.emplace_front(key, std::move(r));
+  store_->index[h] = store_->lru.begin();
+
+  if (store_->lru.size() > capacity_) {
+    store_->index.erase(store::hash(store_->lru.back().first));
+    store_->lru.pop_back();
+  }
+}
+
+YACL_INLINE std::string map::cache_key(char source, bool missing_program_name, bool ignore_program_name,
+                                       const matches& env) const {
+  std::size_t fields[] = {table->uid(), table->version(), id, env.size()};
+
+  std::string k(reinterpret_cast<const char*>(fields), sizeof(fields));
+  for (auto& m : env) {
+    k.append(reinterpret_cast<const char*>(&m.first), sizeof(m.first));
+    k.append(m.second).push_back('\0');
+  }
+
+  k += source;
+  k += static_cast<char>(missing_program_name);
+  k += static_cast<char>(ignore_program_name);
+  return k;
+}
+
+YACL_INLINE bool map::replay(parse_cache& cache, const std::string& key, const matches& env) {
+  context& st = state();
+  auto r = cache.find(key);
+  if (!r)
+    return false;
+
+  reset();
+  st.tokens = r->tokens;
+  st.env_values = env;
+  st.parsed_version = table->version();
+  st.warnings = r->warnings;
+
+  for (auto& m : r->found) {
+    if (!table->enabled.test(m.first))
+      st.active.push_back(m.first);
+
+    enable(m.first, m.second);
+    if (table->dictionaries.test(m.first))
+      st.definitions[m.first].push_back(m.second);
+  }
+
+  for (auto& v : r->values)
+    table->options[v.first]->load_value(v.second);
+
+  announce(r->found);
+  return true;
+}
+
+YACL_INLINE bool map::record(parse_cache& cache, const std::string& key, convert& c, const matches& env,
+                             bool missing_program_name, bool ignore_program_name) {
+  context& st = state();
+  reset();
+  std::string args = arguments(c, missing_program_name, ignore_program_name);
+
+  matches found;
+  scan(args, found);
+  fallback(found, env);
+  apply(found);
+
+  st.tokens.swap(args);
+  st.env_values = env;
+  st.parsed_version = table->version();
+
+  auto r = std::make_shared<parse_cache::result>();
+  r->found = std::move(found);
+  r->tokens = st.tokens;
+  r->warnings = st.warnings;
+
+  for (auto o : st.active) {
+    if (!table->options[o])
+      continue;
+
+    r->values.emplace_back(o, tdata::BData());
+    table->options[o]->save_value(r->values.back().second);
+  }
+
+  cache.insert(key, std::move(r));
+  return true;
+}
+
+YACL_INLINE bool map::parse(convert c, parse_cache& cache, bool missing_program_name, bool ignore_program_name) {
+  if (!table)
+    return parse(c, missing_program_name, ignore_program_name);
+
+  matches env = environment();
+  std::string key = cache_key('a', missing_program_name, ignore_program_name, env);
+  for (std::size_t i = 0; i < c.size(); ++i)
+    key.append(c.token(i)).push_back('\0');
+
+  return replay(cache, key, env) || record(cache, key, c, env, missing_program_name, ignore_program_name);
+}
+
+YACL_INLINE bool map::parse(std::string v, parse_cache& cache, bool missing_program_name, bool ignore_program_name) {
+  if (!table)
+    return parse(v, missing_program_name, ignore_program_name);
+
+  matches env = environment();
+  std::string key = cache_key('s', missing_program_name, ignore_program_name, env);
+  key += v;
+  if (replay(cache, key, env))
+    return true;
+
+  convert c(v);
+  return record(cache, key, c, env, missing_program_name, ignore_program_name);
+}
+
+YACL_INLINE bool map::parse(int argc, char **argv, parse_cache& cache, bool missing_program_name, bool ignore_program_name) {
+  if (!table)
+    return parse(argc, argv, missing_program_name, ignore_program_name);
+
+  matches env = environment();
+  std::string key = cache_key('a', missing_program_name, ignore_program_name, env);
+  for (int i = 0; i < argc; ++i)
+    key.append(argv[i]).push_back('\0');
+  if (replay(cache, key, env))
+    return true;
+
+  convert c(argc, argv);
+  return record(cache, key, c, env, missing_program_name, ignore_program_name);
+}
+
+YACL_INLINE diff map::reparse(convert c, bool missing_program_name, bool ignore_program_name) {
+  context& st = state();
+  diff d;
+  std::string args = arguments(c, missing_program_name, ignore_program_name);
+  matches env = environment();
+  if (!table || (st.parsed_version == table->version() && args == st.tokens && env == st.env_values))
+    return d;
+
+  // the warnings are those of the new command line, the previous ones
+  // come back when it is rejected
+  std::vector<std::string> previous_warnings;
+  previous_warnings.swap(st.warnings);
+
+  matches found;
+  try {
+    scan(args, found);
+  } catch (...) {
+    st.warnings.swap(previous_warnings);
+    throw;
+  }
+  fallback(found, env);
+
+  // last occurrence wins, as in parse(), but a dictionary option is
+  // made of all its definitions
+  std::unordered_map<std::size_t, std::size_t> last;
+  std::unordered_map<std::size_t, std::vector<std::string>> defined;
+  for (std::size_t i = 0; i < found.size(); ++i) {
+    last[found[i].first] = i;
+    if (table->dictionaries.test(found[i].first))
+      defined[found[i].first].push_back(found[i].second);
+  }
+
+  std::vector<std::size_t> removed, still_active;
+  for (auto o : st.active) {
+    if (last.find(o) != last.end()) {
+      still_active.push_back(o);
+      continue;
+    }
+
+    d.removed.push_back(table->names[o]);
+    removed.push_back(o);
+  }
+
+  matches updated;
+  for (std::size_t i = 0; i < found.size(); ++i) {
+    std::size_t o = found[i].first;
+    bool was_enabled = table->enabled.test(o);
+    auto dict = defined.find(o);
+    if (dict == defined.end() ? last[o] != i || (was_enabled && table->values[o] == found[i].second)
+                              : was_enabled && st.definitions[o] == dict->second)
+      continue;
+
+    if (last[o] == i) {
+      if (was_enabled) {
+        d.changed.push_back(table->names[o]);
+      } else {
+        d.added.push_back(table->names[o]);
+        still_active.push_back(o);
+      }
+    }
+
+    updated.push_back(std::move(found[i]));
+  }
+
+  // nothing changes before the new values are converted and checked
+  snapshot converted;
+  try {
+    validate(updated, &converted);
+  } catch (...) {
+    st.warnings.swap(previous_warnings);
+    throw;
+  }
+
+  bitset was_enabled = table->enabled;
+  auto previous_definitions = st.definitions;
+  matches previous;
+  for (auto o : removed) {
+    st.definitions.erase(o);
+    previous.emplace_back(o, std::move(table->values[o]));
+    table->values[o].clear();
+    table->enabled.set(o, false);
+  }
+
+  for (auto& m : updated) {
+    previous.emplace_back(m.first, table->values[m.first]);
+    enable(m.first, m.second);
+  }
+
+  for (auto& e : defined)
+    st.definitions[e.first] = std::move(e.second);
+  st.active.swap(still_active);
+  st.tokens.swap(args);
+  st.env_values.swap(env);
+
+  try {
+    table->check(scope());
+  } catch (...) {
+    // the first value saved for an option is the one it had
+    for (auto p = previous.rbegin(); p != previous.rend(); ++p)
+      table->values[p->first] = std::move(p->second);
+    table->enabled = std::move(was_enabled);
+    st.definitions.swap(previous_definitions);
+    st.active.swap(still_active);
+    st.tokens.swap(args);
+    st.env_values.swap(env);
+    st.warnings.swap(previous_warnings);
+    for (auto& v : converted)
+      table->options[v.first]->load_value(v.second);
+    throw;
+  }
+
+  st.parsed_version = table->version();
+
+  for (auto o : removed)
+    table->node(o).notify("", true);
+  announce(updated);
+  return d;
+}
+
+YACL_INLINE schema::schema() {
+  static std::atomic<std::size_t> uids(0);
+  uid_ = ++uids;
+}
+
+YACL_INLINE schema::~schema() {}
+
+YACL_INLINE std::size_t schema::add(const std::string& name) {
+  std::size_t id = names.size();
+  ++version_;
+
+  names.push_back(name);
+  spellings.push_back(name);
+  short_names.emplace_back();
+  helps.emplace_back();
+  types.push_back(OptionAbstract::OPTIONAL);
+  values.emplace_back();
+  variables.emplace_back();
+  options.emplace_back();
+  nodes.emplace_back(new map(this, id));
+
+  return id;
+}
+
+YACL_INLINE void schema::add_constraint(constraint_type type, const std::vector<map*>& group) {
+  if (group.size() < 2)
+    throw std::domain_error("A constraint needs at least two options");
+
+  schema* s = group.front()->table;
+  for (auto m : group)
+    if (!s || m->table != s || m->id == npos)
+      throw std::domain_error("Constrained options must belong to the same map");
+
+  constraint c;
+  c.type = type;
+  c.trigger = group.front()->id;
+
+  auto group_begin = group.begin();
+  if (type == DEPENDS)
+    ++group_begin;
+
+  std::size_t lo = group.front()->id, hi = lo;
+  for (auto it = group_begin; it != group.end(); ++it) {
+    lo = std::min(lo, (*it)->id);
+    hi = std::max(hi, (*it)->id);
+  }
+
+  c.first_word = lo / bitset::word_bits;
+  c.mask.assign(hi / bitset::word_bits - c.first_word + 1, 0);
+  for (auto it = group_begin; it != group.end(); ++it) {
+    std::size_t bit = (*it)->id - c.first_word * bitset::word_bits;
+    c.mask[bit / bitset::word_bits] |= bitset::word(1) << (bit % bitset::word_bits);
+  }
+
+  s->constraints.push_back(std::move(c));
+  ++s->version_;
+}
+
+YACL_INLINE std::string schema::describe(const constraint& c) const {
+  std::string s;
+  for (std::size_t w = 0; w < c.mask.size(); ++w)
+    for (std::size_t b = 0; b < bitset::word_bits; ++b)
+      if ((c.mask[w] >> b) & 1)
+        s += (s.empty() ? "[" : ", [") +
+            names[(c.first_word + w) * bitset::word_bits + b] + "]";
+  return s;
+}
+
+YACL_INLINE void schema::check(const bitset& scope) const {
+  const auto& on = enabled.words;
+  const auto& in = scope.words;
+
+  for (std::size_t w = 0; w < required.words.size(); ++w) {
+    bitset::word missing = required.words[w] & (w < in.size() ? in[w] : 0) &
+        ~(w < on.size() ? on[w] : 0);
+    if (missing) {
+      std::size_t b = 0;
+      while (!((missing >> b) & 1)) ++b;
+      throw std::domain_error("Required option [" +
+                              names[w * bitset::word_bits + b] + "] is missing");
+    }
+  }
+
+  for (auto& c : constraints) {
+    if (!scope.test(c.trigger))
+      continue;
+
+    std::size_t n = 0, total = 0;
+    for (std::size_t w = 0; w < c.mask.size(); ++w) {
+      std::size_t ow = c.first_word + w;
+      n += bitset::popcount(c.mask[w] & (ow < on.size() ? on[ow] : 0));
+      total += bitset::popcount(c.mask[w]);
+    }
+
+    switch (c.type) {
+      case EXCLUDE:
+        if (n > 1)
+          throw std::domain_error("The options " + describe(c) + " are mutually exclusive");
+        break;
+      case INCLUDE:
+        if (n != 0 && n != total)
+          throw std::domain_error("The options " + describe(c) + " must be used together");
+        break;
+      case DEPENDS:
+        if (enabled.test(c.trigger) && n != total)
+          throw std::domain_error("The option [" + names[c.trigger] +
+                                  "] requires " + describe(c));
+        break;
+      case AT_LEAST_ONE:
+        if (n == 0)
+          throw std::domain_error("At least one of the options " + describe(c) + " is required");
+        break;
+    }
+  }
+}
+
+YACL_INLINE bool split_assignment(std::string::const_iterator first, std::string::const_iterator last,
+                                  std::string& name, std::string& value) {
+  auto eq = std::find(first, last, '=');
+  if (eq == last)
+    return false;
+
+  name.assign(first, eq);
+  value.assign(eq + 1, last);
+  return true;
+}
+
+YACL_INLINE void dictionary::clear() {
+  entries.clear();
+  hashes.clear();
+  slots.clear();
+}
+
+YACL_INLINE void dictionary::reserve(std::size_t n) {
+  entries.reserve(n);
+  hashes.reserve(n);
+  if (2 * n > slots.size())
+    rehash(2 * n);
+}
+
+YACL_INLINE void dictionary::set(const std::string& name, const std::string& value) {
+  if (2 * (entries.size() + 1) > slots.size())
+    rehash(2 * (entries.size() + 1));
+
+  std::size_t h = std::hash<std::string>()(name);
+  std::size_t i = probe(name, h);
+  if (slots[i]) {
+    entries[slots[i] - 1].second = value;
+    return;
+  }
+
+  entries.emplace_back(name, value);
+  hashes.push_back(h);
+  slots[i] = entries.size();
+}
+
+YACL_INLINE void dictionary::define(const std::string& definition) {
+  std::string name, value;
+  if (!split_assignment(definition.begin(), definition.end(), name, value))
+    name = definition;
+
+  if (name.empty())
+    throw std::domain_error("Invalid definition [" + definition + "]");
+  set(name, value);
+}
+
+YACL_INLINE const std::string* dictionary::find(const std::string& name) const {
+  if (slots.empty())
+    return nullptr;
+
+  std::size_t i = probe(name, std::hash<std::string>()(name));
+  return slots[i] ? &entries[slots[i] - 1].second : nullptr;
+}
+
+YACL_INLINE const std::string& dictionary::at(const std::string& name) const {
+  const std::string* v = find(name);
+  if (!v)
+    throw std::domain_error("The name [" + name + "] is not defined");
+  return *v;
+}
+
+YACL_INLINE std::size_t dictionary::probe(const std::string& name, std::size_t hash) const {
+  std::size_t mask = slots.size() - 1;
+  for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+    std::size_t e = slots[i];
+    if (!e || (hashes[e - 1] == hash && entries[e - 1].first == name))
+      return i;
+  }
+}
+
+YACL_INLINE void dictionary::rehash(std::size_t capacity) {
+  std::size_t n = 16;
+  while (n < capacity)
+    n <<= 1;
+
+  slots.assign(n, 0);
+  for (std::size_t e = 0; e < entries.size(); ++e) {
+    std::size_t i = hashes[e] & (n - 1);
+    while (slots[i])
+      i = (i + 1) & (n - 1);
+    slots[i] = e + 1;
+  }
+}
+
+template <>
+YACL_INLINE dictionary FilterStringStream<dictionary>::filter(const std::string& s) {
+  dictionary d;
+  d.define(s);
+  return d;
+}
+
+YACL_INLINE void file_batch::add(const std::string& path) {
+  if (index.emplace(path, paths.size()).second) {
+    paths.push_back(path);
+    kinds.push_back(UNKNOWN);
+  }
+}
+
+YACL_INLINE int file_batch::kind(const std::string& path) const {
+  auto i = index.find(path);
+  return i == index.end() ? UNKNOWN : kinds[i->second];
+}
+
+YACL_INLINE int file_batch::kind_of(const std::string& path) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0)
+    return MISSING;
+  if (S_ISREG(st.st_mode))
+    return REGULAR_FILE;
+  if (S_ISDIR(st.st_mode))
+    return DIRECTORY;
+  return ANY_FILE;
+}
+
+YACL_INLINE const file_batch*& file_batch::current() {
+  static thread_local const file_batch* batch = nullptr;
+  return batch;
+}
+
+YACL_INLINE bool file_check(const std::string& path, file_type type) {
+  const file_batch* batch = file_batch::current();
+  int kind = batch ? batch->kind(path) : file_batch::UNKNOWN;
+  if (kind == file_batch::UNKNOWN)
+    kind = file_batch::kind_of(path);
+
+  return kind != file_batch::MISSING && (type == ANY_FILE || kind == type);
+}
+
+YACL_INLINE std::ostream& operator<<(std::ostream&os, map&m) {
+  os << m.to_string();
+  return os;
+}
+
+}